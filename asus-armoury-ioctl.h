@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+ *
+ * Userspace interface of the asus-armoury character device
+ *
+ *  Copyright (c) 2024 Luke Jones <luke@ljones.dev>
+ */
+
+#ifndef _ASUS_ARMOURY_IOCTL_H_
+#define _ASUS_ARMOURY_IOCTL_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Most entries a single batch may hold */
+#define ASUS_ARMOURY_BATCH_MAX		64
+
+/**
+ * struct asus_armoury_entry - One value of a batch.
+ * @dev_id: WMI device ID of the attribute, as in the debugfs statistics.
+ * @value: The current_value of the attribute, read or to be written.
+ * @status: Set by the driver to 0, or to the negative errno sysfs would
+ *	    have returned for the same read or write, -EACCES for a write to a
+ *	    read-only attribute.
+ * @reserved: Must be 0.
+ */
+struct asus_armoury_entry {
+	__u32 dev_id;
+	__u32 value;
+	__s32 status;
+	__u32 reserved;
+};
+
+/**
+ * struct asus_armoury_batch - Argument of the batch ioctls.
+ * @count: Number of entries, at most ASUS_ARMOURY_BATCH_MAX.
+ * @flags: Must be 0.
+ * @entries: Pointer to the array of entries.
+ */
+struct asus_armoury_batch {
+	__u32 count;
+	__u32 flags;
+	__u64 entries;
+};
+
+#define ARMOURY_STATE_MAGIC		0x53414141	/* "AAAS" */
+#define ARMOURY_STATE_VERSION		2
+
+/* Entries the state page has room for, one bit each in @present and @valid */
+#define ARMOURY_STATE_MAX_ENTRIES	64
+
+/**
+ * struct armoury_state_page - State of an instance, mapped read-only.
+ * @magic: ARMOURY_STATE_MAGIC.
+ * @version: ARMOURY_STATE_VERSION.
+ * @count: Number of entries in use.
+ * @seq: Odd while the page is being updated. A consistent copy is one made
+ *	 between two reads of the same even @seq, with read barriers in between.
+ * @pending_reboot: 1 if a change needs a reboot to take effect.
+ * @generation: Incremented on every change of the page.
+ * @present: Bit i is set if @dev_id[i] is present.
+ * @valid: Bit i is set once @value[i] is known.
+ * @dev_id: WMI device ID of each entry.
+ * @value: The raw value last written to or read from @dev_id[i], less the
+ *	   presence bit. The PPT, Nvidia and dGPU TGP limits hold the value of
+ *	   their current_value instead.
+ * @gen: The @generation at which @value[i] last changed, so a client can
+ *	 tell what changed since the generation it last saw.
+ *
+ * Mapped from the asus-armoury misc device. All fields are naturally aligned,
+ * the layout has no implicit padding.
+ */
+struct armoury_state_page {
+	__u32 magic;
+	__u16 version;
+	__u16 count;
+	__u32 seq;
+	__u32 pending_reboot;
+	__u64 generation;
+	__u64 present;
+	__u64 valid;
+	__u32 dev_id[ARMOURY_STATE_MAX_ENTRIES];
+	__u32 value[ARMOURY_STATE_MAX_ENTRIES];
+	__u64 gen[ARMOURY_STATE_MAX_ENTRIES];
+};
+
+#define ASUS_ARMOURY_IOC_MAGIC		0xAA
+
+/* Entries are read or written in order, a failed one does not stop the rest */
+#define ASUS_ARMOURY_IOC_GET	_IOWR(ASUS_ARMOURY_IOC_MAGIC, 0x01, struct asus_armoury_batch)
+#define ASUS_ARMOURY_IOC_SET	_IOWR(ASUS_ARMOURY_IOC_MAGIC, 0x02, struct asus_armoury_batch)
+
+#endif /* _ASUS_ARMOURY_IOCTL_H_ */
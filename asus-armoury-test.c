@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for asus-armoury, on instances of the mock WMI backend.
+ *
+ * Included at the end of asus-armoury.c so the tests can reach its static
+ * functions and attributes.
+ */
+
+#include <kunit/test.h>
+
+struct armoury_test {
+	struct armoury_mock mock;
+	struct asus_armoury_priv *priv;
+	struct kobject *kobj;
+};
+
+static void armoury_test_set(struct armoury_test *t, u32 dev_id, u32 value)
+{
+	struct armoury_mock_devstate *state = armoury_mock_find(&t->mock, dev_id);
+
+	spin_lock(&t->mock.lock);
+	state->value = value;
+	spin_unlock(&t->mock.lock);
+}
+
+static u32 armoury_test_get(struct armoury_test *t, u32 dev_id)
+{
+	struct armoury_mock_devstate *state = armoury_mock_find(&t->mock, dev_id);
+	u32 value;
+
+	spin_lock(&t->mock.lock);
+	value = state->value;
+	spin_unlock(&t->mock.lock);
+
+	return value;
+}
+
+static void armoury_test_fail(struct armoury_test *t, u32 dev_id, u32 result,
+			      int err)
+{
+	struct armoury_mock_devstate *state = armoury_mock_find(&t->mock, dev_id);
+
+	spin_lock(&t->mock.lock);
+	state->result = result;
+	state->err = err;
+	spin_unlock(&t->mock.lock);
+}
+
+/*
+ * Each test gets its own instance with 8 performance and 16 efficiency
+ * cores at most, 6 and 12 of them in use, and the MUX in hybrid mode.
+ */
+static int armoury_test_init(struct kunit *test)
+{
+	struct armoury_test *t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	armoury_mock_init(&t->mock);
+	armoury_test_set(t, ASUS_WMI_DEVID_CORES_MAX,
+			 FIELD_PREP(ASUS_PERF_CORE_MASK, 8) |
+			 FIELD_PREP(ASUS_POWER_CORE_MASK, 16));
+	armoury_test_set(t, ASUS_WMI_DEVID_CORES,
+			 FIELD_PREP(ASUS_PERF_CORE_MASK, 6) |
+			 FIELD_PREP(ASUS_POWER_CORE_MASK, 12));
+	armoury_test_set(t, ASUS_WMI_DEVID_GPU_MUX, 1);
+
+	t->priv = asus_armoury_add(&armoury_mock_ops, &t->mock);
+	if (IS_ERR(t->priv)) {
+		int err = PTR_ERR(t->priv);
+
+		kfree(t);
+		return err;
+	}
+	t->mock.priv = t->priv;
+	t->kobj = &t->priv->fw_attr_kset->kobj;
+
+	test->priv = t;
+	return 0;
+}
+
+static void armoury_test_exit(struct kunit *test)
+{
+	struct armoury_test *t = test->priv;
+
+	asus_armoury_del(t->priv);
+	kfree(t);
+}
+
+static ssize_t armoury_test_store(struct armoury_test *t,
+				  struct kobj_attribute *attr, const char *buf)
+{
+	return attr->store(t->kobj, attr, buf, strlen(buf));
+}
+
+/* Shows @attr as read fresh from the mock */
+static void armoury_test_show(struct armoury_test *t,
+			      struct kobj_attribute *attr, char *buf)
+{
+	armoury_devstate_invalidate_all(t->priv);
+	attr->show(t->kobj, attr, buf);
+}
+
+static void armoury_test_attr_int_store(struct kunit *test)
+{
+	struct kobj_attribute *attr = &attr_boot_sound_current_value;
+	struct armoury_test *t = test->priv;
+	u32 dev_id = ASUS_WMI_DEVID_BOOT_SOUND;
+
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "1", 1, 0, 1, dev_id), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, dev_id), 1);
+
+	/* Out of range or not a number, nothing reaches firmware */
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "2", 1, 0, 1, dev_id),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "on", 2, 0, 1, dev_id),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, dev_id), 1);
+
+	/* Firmware refusing the value is -EIO */
+	armoury_test_fail(t, dev_id, 0, 0);
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "0", 1, 0, 1, dev_id),
+			-EIO);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, dev_id), 1);
+
+	/* A failed call returns its own error */
+	armoury_test_fail(t, dev_id, 1, -ETIMEDOUT);
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "0", 1, 0, 1, dev_id),
+			-ETIMEDOUT);
+
+	armoury_test_fail(t, dev_id, 1, 0);
+	KUNIT_EXPECT_EQ(test, attr_int_store(t->kobj, attr, "0", 1, 0, 1, dev_id), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, dev_id), 0);
+}
+
+static void armoury_test_mini_led(struct kunit *test)
+{
+	struct kobj_attribute *attr = &attr_mini_led_mode_current_value;
+	struct armoury_test *t = test->priv;
+	char *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	/* The first generation only has off and on */
+	t->priv->mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE;
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "1"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_MINI_LED_MODE),
+			ASUS_MINI_LED_ON);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "2"), -EINVAL);
+
+	/* The 2024 values are remapped to keep 0 off and 1 on */
+	t->priv->mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE2;
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "0"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_MINI_LED_MODE2),
+			ASUS_MINI_LED_2024_OFF);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "1"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_MINI_LED_MODE2),
+			ASUS_MINI_LED_2024_WEAK);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "2"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_MINI_LED_MODE2),
+			ASUS_MINI_LED_2024_STRONG);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "3"), -EINVAL);
+
+	armoury_test_set(t, ASUS_WMI_DEVID_MINI_LED_MODE2, ASUS_MINI_LED_2024_OFF);
+	armoury_test_show(t, attr, buf);
+	KUNIT_EXPECT_STREQ(test, buf, "0\n");
+	armoury_test_set(t, ASUS_WMI_DEVID_MINI_LED_MODE2, ASUS_MINI_LED_2024_WEAK);
+	armoury_test_show(t, attr, buf);
+	KUNIT_EXPECT_STREQ(test, buf, "1\n");
+	armoury_test_set(t, ASUS_WMI_DEVID_MINI_LED_MODE2, ASUS_MINI_LED_2024_STRONG);
+	armoury_test_show(t, attr, buf);
+	KUNIT_EXPECT_STREQ(test, buf, "2\n");
+}
+
+static void armoury_test_apu_mem(struct kunit *test)
+{
+	static const u32 mem[] = { 0, 258, 259, 260, 261, 263, 264, 265, 262 };
+	struct kobj_attribute *attr = &attr_apu_mem_current_value;
+	struct armoury_test *t = test->priv;
+	char buf[16];
+
+	/* Every index is written as its raw value and read back the same */
+	for (int i = 0; i < ARRAY_SIZE(mem); i++) {
+		snprintf(buf, sizeof(buf), "%d", i);
+		KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, buf), strlen(buf));
+		KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_APU_MEM), mem[i]);
+		KUNIT_EXPECT_EQ(test, armoury_apu_mem_index(mem[i]), i);
+	}
+
+	KUNIT_EXPECT_EQ(test, armoury_apu_mem_index(256), 0);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, attr, "9"), -EIO);
+}
+
+static void armoury_test_cores(struct kunit *test)
+{
+	struct armoury_test *t = test->priv;
+	struct rog_tunables *rog;
+	char *buf;
+
+	rog = kunit_kzalloc(test, sizeof(*rog), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, rog);
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	KUNIT_ASSERT_EQ(test, init_max_cpu_cores(t->priv, rog), 0);
+	KUNIT_EXPECT_EQ(test, rog->max_perf_cores, 8);
+	KUNIT_EXPECT_EQ(test, rog->max_power_cores, 16);
+	KUNIT_EXPECT_EQ(test, rog->cur_perf_cores, 6);
+	KUNIT_EXPECT_EQ(test, rog->cur_power_cores, 12);
+
+	/* Each store keeps the other core type at its current count */
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_cores_performance_current_value, "5"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_CORES),
+			FIELD_PREP(ASUS_PERF_CORE_MASK, 5) |
+			FIELD_PREP(ASUS_POWER_CORE_MASK, 12));
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_cores_efficiency_current_value, "10"), 2);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_CORES),
+			FIELD_PREP(ASUS_PERF_CORE_MASK, 5) |
+			FIELD_PREP(ASUS_POWER_CORE_MASK, 10));
+	armoury_test_show(t, &attr_cores_performance_current_value, buf);
+	KUNIT_EXPECT_STREQ(test, buf, "5\n");
+	armoury_test_show(t, &attr_cores_efficiency_current_value, buf);
+	KUNIT_EXPECT_STREQ(test, buf, "10\n");
+
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_cores_performance_current_value, "3"), -EINVAL);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_cores_performance_current_value, "9"), -EINVAL);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_cores_efficiency_current_value, "17"), -EINVAL);
+}
+
+static void armoury_test_gpu_interlocks(struct kunit *test)
+{
+	struct kobj_attribute *mux = &attr_gpu_mux_mode_current_value;
+	struct armoury_test *t = test->priv;
+	u32 value;
+
+	KUNIT_ASSERT_EQ(test, t->priv->gpu_mux_dev_id, ASUS_WMI_DEVID_GPU_MUX);
+
+	/* The MUX must not go to dGPU mode on a cached, stale dGPU state */
+	KUNIT_ASSERT_EQ(test, armoury_get_devstate(t->priv, ASUS_WMI_DEVID_DGPU,
+						   &value), 0);
+	armoury_test_set(t, ASUS_WMI_DEVID_DGPU, 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, mux, "0"), -ENODEV);
+	armoury_test_set(t, ASUS_WMI_DEVID_DGPU, 0);
+
+	armoury_test_set(t, ASUS_WMI_DEVID_EGPU, 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, mux, "0"), -ENODEV);
+	armoury_test_set(t, ASUS_WMI_DEVID_EGPU, 0);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_GPU_MUX), 1);
+
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t, mux, "0"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_GPU_MUX), 0);
+
+	/* With the MUX in dGPU mode, neither GPU can be switched off */
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_dgpu_disable_current_value, "1"), -ENODEV);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_DGPU), 0);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_egpu_enable_current_value, "1"), -ENODEV);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_EGPU), 0);
+
+	armoury_test_set(t, ASUS_WMI_DEVID_GPU_MUX, 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_store(t,
+			&attr_dgpu_disable_current_value, "1"), 1);
+	KUNIT_EXPECT_EQ(test, armoury_test_get(t, ASUS_WMI_DEVID_DGPU), 1);
+}
+
+static struct kunit_case armoury_test_cases[] = {
+	KUNIT_CASE(armoury_test_attr_int_store),
+	KUNIT_CASE(armoury_test_mini_led),
+	KUNIT_CASE(armoury_test_apu_mem),
+	KUNIT_CASE(armoury_test_cores),
+	KUNIT_CASE(armoury_test_gpu_interlocks),
+	{}
+};
+
+static struct kunit_suite armoury_test_suite = {
+	.name = "asus-armoury",
+	.init = armoury_test_init,
+	.exit = armoury_test_exit,
+	.test_cases = armoury_test_cases,
+};
+kunit_test_suite(armoury_test_suite);
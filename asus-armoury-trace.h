@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * Tracepoints for the asus-armoury driver
+ *
+ *  Copyright (c) 2024 Luke Jones <luke@ljones.dev>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM asus_armoury
+
+#if !defined(_ASUS_ARMOURY_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _ASUS_ARMOURY_TRACE_H_
+
+#include <linux/kobject.h>
+#include <linux/string.h>
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+/* Long enough for every group and attribute name the driver creates */
+#define ASUS_ARMOURY_TRACE_NAME_LEN	32
+
+DECLARE_EVENT_CLASS(asus_armoury_attr,
+
+	TP_PROTO(int id, struct kobj_attribute *attr),
+
+	TP_ARGS(id, attr),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__array(char, group, ASUS_ARMOURY_TRACE_NAME_LEN)
+		__array(char, name, ASUS_ARMOURY_TRACE_NAME_LEN)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		strscpy(__entry->group, armoury_attr_group_name(attr) ?: "",
+			ASUS_ARMOURY_TRACE_NAME_LEN);
+		strscpy(__entry->name, attr->attr.name,
+			ASUS_ARMOURY_TRACE_NAME_LEN);
+	),
+
+	TP_printk("id=%d attr=%s/%s", __entry->id, __entry->group,
+		  __entry->name)
+);
+
+DEFINE_EVENT(asus_armoury_attr, asus_armoury_attr_show_enter,
+	TP_PROTO(int id, struct kobj_attribute *attr),
+	TP_ARGS(id, attr)
+);
+
+DEFINE_EVENT(asus_armoury_attr, asus_armoury_attr_store_enter,
+	TP_PROTO(int id, struct kobj_attribute *attr),
+	TP_ARGS(id, attr)
+);
+
+DEFINE_EVENT(asus_armoury_attr, asus_armoury_sysfs_notify,
+	TP_PROTO(int id, struct kobj_attribute *attr),
+	TP_ARGS(id, attr)
+);
+
+DECLARE_EVENT_CLASS(asus_armoury_attr_exit,
+
+	TP_PROTO(int id, struct kobj_attribute *attr, ssize_t ret),
+
+	TP_ARGS(id, attr, ret),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__array(char, group, ASUS_ARMOURY_TRACE_NAME_LEN)
+		__array(char, name, ASUS_ARMOURY_TRACE_NAME_LEN)
+		__field(long, ret)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		strscpy(__entry->group, armoury_attr_group_name(attr) ?: "",
+			ASUS_ARMOURY_TRACE_NAME_LEN);
+		strscpy(__entry->name, attr->attr.name,
+			ASUS_ARMOURY_TRACE_NAME_LEN);
+		__entry->ret = ret;
+	),
+
+	TP_printk("id=%d attr=%s/%s ret=%ld", __entry->id, __entry->group,
+		  __entry->name, __entry->ret)
+);
+
+DEFINE_EVENT(asus_armoury_attr_exit, asus_armoury_attr_show_exit,
+	TP_PROTO(int id, struct kobj_attribute *attr, ssize_t ret),
+	TP_ARGS(id, attr, ret)
+);
+
+DEFINE_EVENT(asus_armoury_attr_exit, asus_armoury_attr_store_exit,
+	TP_PROTO(int id, struct kobj_attribute *attr, ssize_t ret),
+	TP_ARGS(id, attr, ret)
+);
+
+TRACE_EVENT(asus_armoury_wmi_call,
+
+	TP_PROTO(int id, u32 method_id, u32 dev_id, u32 arg, u32 retval,
+		 int err, u64 duration_ns, u32 smis),
+
+	TP_ARGS(id, method_id, dev_id, arg, retval, err, duration_ns, smis),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u32, method_id)
+		__field(u32, dev_id)
+		__field(u32, arg)
+		__field(u32, retval)
+		__field(int, err)
+		__field(u64, duration_ns)
+		__field(u32, smis)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->method_id = method_id;
+		__entry->dev_id = dev_id;
+		__entry->arg = arg;
+		__entry->retval = retval;
+		__entry->err = err;
+		__entry->duration_ns = duration_ns;
+		__entry->smis = smis;
+	),
+
+	TP_printk("id=%d method=0x%08x dev_id=0x%08x arg=0x%x retval=0x%x err=%d duration_ns=%llu smis=%u",
+		  __entry->id, __entry->method_id, __entry->dev_id,
+		  __entry->arg, __entry->retval, __entry->err,
+		  __entry->duration_ns, __entry->smis)
+);
+
+TRACE_EVENT(asus_armoury_wmi_event,
+
+	TP_PROTO(int id, u64 code, unsigned long watches),
+
+	TP_ARGS(id, code, watches),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, code)
+		__field(unsigned long, watches)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->code = code;
+		__entry->watches = watches;
+	),
+
+	TP_printk("id=%d code=0x%llx watches=0x%lx", __entry->id, __entry->code,
+		  __entry->watches)
+);
+
+TRACE_EVENT(asus_armoury_pending_reboot,
+
+	TP_PROTO(int id, bool pending),
+
+	TP_ARGS(id, pending),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(bool, pending)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->pending = pending;
+	),
+
+	TP_printk("id=%d pending=%d", __entry->id, __entry->pending)
+);
+
+#endif /* _ASUS_ARMOURY_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE asus-armoury-trace
+
+#include <trace/define_trace.h>
@@ -11,23 +11,58 @@
  */
 
  #include <linux/bitfield.h>
+ #include <linux/completion.h>
+ #include <linux/configfs.h>
+ #include <linux/crc32.h>
+ #include <linux/debugfs.h>
+ #include <linux/delay.h>
  #include <linux/device.h>
  #include <linux/dmi.h>
  #include <linux/errno.h>
+ #include <linux/firmware.h>
  #include <linux/fs.h>
+ #include <linux/idr.h>
+ #include <linux/jiffies.h>
  #include <linux/kernel.h>
  #include <linux/kmod.h>
  #include <linux/kobject.h>
+ #include <linux/log2.h>
+ #include <linux/ktime.h>
+ #include <linux/miscdevice.h>
+ #include <linux/mm.h>
  #include <linux/module.h>
+ #include <linux/moduleparam.h>
  #include <linux/mutex.h>
+ #include <linux/overflow.h>
+ #include <linux/pci.h>
+ #include <linux/percpu.h>
  #include <linux/platform_data/x86/asus-wmi.h>
+ #include <linux/platform_profile.h>
+ #include <linux/pm.h>
+ #include <linux/rcupdate.h>
+ #include <linux/reboot.h>
+ #include <linux/sched/signal.h>
+ #include <linux/seq_file.h>
+ #include <linux/spinlock.h>
  #include <linux/types.h>
+ #include <linux/uaccess.h>
+ #include <linux/vgaarb.h>
+ #include <linux/vmalloc.h>
+ #include <linux/wait.h>
+ #include <linux/workqueue.h>
+ #include <linux/wmi.h>
+ #include <asm/msr.h>
+ #include <asm/processor.h>
 
 #include "asus-armoury.h"
+#include "asus-armoury-ioctl.h"
 #include "firmware_attributes_class.h"
 #include "asus-wmi.h"
 
-#define ASUS_NB_WMI_EVENT_GUID	"0B3CBB35-E3C2-45ED-91C2-4C5A6D195D1C"
+#define CREATE_TRACE_POINTS
+#include "asus-armoury-trace.h"
+
+#define ASUS_WMI_MGMT_GUID	"97845ED0-4E6D-11DE-8A39-0800200C9A66"
 
 #define ASUS_MINI_LED_MODE_MASK		0x03
 /* Standard modes for devices with only on/off */
@@ -107,953 +142,6160 @@ struct rog_tunables {
 	u32 cur_power_cores;
 	u32 min_power_cores;
 	u32 max_power_cores;
+
+	struct rcu_head rcu;
 };
 
 static const struct class *fw_attr_class;
 
+static bool write_elision = true;
+module_param(write_elision, bool, 0644);
+MODULE_PARM_DESC(write_elision,
+		 "Skip stores of values written to firmware less than cache_max_age_ms ago (default: true)");
+
+static unsigned int coalesce_quiet_ms;
+module_param(coalesce_quiet_ms, uint, 0644);
+MODULE_PARM_DESC(coalesce_quiet_ms,
+		 "Hold back tunable stores until none came for this long in ms (0 writes them at once)");
+
+static unsigned int coalesce_max_ms = 1000;
+module_param(coalesce_max_ms, uint, 0644);
+MODULE_PARM_DESC(coalesce_max_ms,
+		 "Longest a held back tunable store waits for its quiet period in ms");
+
+static unsigned int cache_max_age_ms = 2000;
+module_param(cache_max_age_ms, uint, 0644);
+MODULE_PARM_DESC(cache_max_age_ms,
+		 "Max age in ms of cached WMI device states (0 disables the cache)");
+
+#define ARMOURY_WMI_TRACE_MAX	65536
+
+static unsigned int wmi_trace_entries;
+module_param(wmi_trace_entries, uint, 0444);
+MODULE_PARM_DESC(wmi_trace_entries,
+		 "Size of the per-instance WMI call trace ring (0 disables tracing)");
+
+/* WMI device IDs which are read through the devstate cache or written */
+static const u32 armoury_devids[] = {
+	ASUS_WMI_DEVID_PPT_PL1_SPL,
+	ASUS_WMI_DEVID_PPT_PL2_SPPT,
+	ASUS_WMI_DEVID_PPT_APU_SPPT,
+	ASUS_WMI_DEVID_PPT_PLAT_SPPT,
+	ASUS_WMI_DEVID_PPT_FPPT,
+	ASUS_WMI_DEVID_NV_DYN_BOOST,
+	ASUS_WMI_DEVID_NV_THERM_TARGET,
+	ASUS_WMI_DEVID_DGPU_SET_TGP,
+	ASUS_WMI_DEVID_MINI_LED_MODE,
+	ASUS_WMI_DEVID_MINI_LED_MODE2,
+	ASUS_WMI_DEVID_GPU_MUX,
+	ASUS_WMI_DEVID_GPU_MUX_VIVO,
+	ASUS_WMI_DEVID_DGPU,
+	ASUS_WMI_DEVID_EGPU,
+	ASUS_WMI_DEVID_EGPU_CONNECTED,
+	ASUS_WMI_DEVID_DGPU_BASE_TGP,
+	ASUS_WMI_DEVID_APU_MEM,
+	ASUS_WMI_DEVID_CORES,
+	ASUS_WMI_DEVID_CORES_MAX,
+	ASUS_WMI_DEVID_CHARGE_MODE,
+	ASUS_WMI_DEVID_BOOT_SOUND,
+	ASUS_WMI_DEVID_MCU_POWERSAVE,
+	ASUS_WMI_DEVID_PANEL_OD,
+	ASUS_WMI_DEVID_PANEL_HD,
+};
+
+/*
+ * Shadow of a WMI device state as last returned by DSTS. The generation is
+ * bumped on every invalidation so that a read racing with a store or event
+ * can not repopulate the cache with a value from before the change.
+ *
+ * Only one DSTS evaluation per device ID is in flight at a time. Readers that
+ * arrive while one is running wait for it and share its result, as long as it
+ * was started in the current generation.
+ *
+ * The write shadow holds the last raw value firmware accepted through DEVS.
+ * It is kept apart from the read cache as DSTS does not echo the written value
+ * for every device ID (the PPT limits for example). It expires after
+ * cache_max_age_ms like the read cache, and a firmware event or a
+ * platform_profile change drops it earlier.
+ */
+struct armoury_devstate {
+	u32 value;
+	unsigned long expires;
+	unsigned int gen;
+	bool valid;
+
+	bool busy;
+	unsigned int flight_gen;
+	unsigned int flight_seq;
+	int flight_err;
+	u32 flight_value;
+
+	bool shadow_valid;
+	u32 shadow;
+	unsigned long shadow_expires;
+
+	bool probed;
+	bool present;
+};
+/*
+ * Per-CPU call statistics of a device ID, summed up when shown in debugfs.
+ * Bucket 0 of the latency histograms counts calls of under 1 us, bucket n
+ * those of [2^(n-1), 2^n) us, and the last bucket everything above that.
+ */
+#define ARMOURY_LAT_BUCKETS	24
+
+struct armoury_devid_stats {
+	u64 reads;
+	u64 writes;
+	u64 failures;
+	u64 bad_results;
+	u64 cache_hits;
+	u64 coalesced;
+	u64 elided;
+	u64 absorbed;
+	u64 smis;
+	u64 dsts_lat[ARMOURY_LAT_BUCKETS];
+	u64 devs_lat[ARMOURY_LAT_BUCKETS];
+};
+
+struct armoury_stats {
+	struct armoury_devid_stats devid[ARRAY_SIZE(armoury_devids)];
+};
+
+#define armoury_stat_inc(priv, idx, field) \
+	this_cpu_inc((priv)->stats->devid[idx].field)
+
+struct asus_armoury_priv;
+struct armoury_chardev;
+struct armoury_tx;
+struct armoury_async_slot;
+
+/*
+ * WMI call trace, exported through debugfs wmi_trace as the header followed
+ * by the records oldest first, in host byte order. The DSTS reads done by
+ * get_devstate are recorded under ASUS_WMI_METHODID_DSTS and the writes done
+ * by set_devstate under ASUS_WMI_METHODID_DEVS. @retval is 0 if @err is set.
+ */
+#define ARMOURY_WMI_TRACE_MAGIC		0x54574141	/* "AAWT" */
+#define ARMOURY_WMI_TRACE_VERSION	1
+
+struct armoury_wmi_trace_hdr {
+	u32 magic;
+	u16 version;
+	u16 rec_size;
+	u32 count;
+	u32 dropped;
+};
+
+struct armoury_wmi_trace_rec {
+	u64 start_ns;
+	u32 duration_ns;
+	u32 method_id;
+	u32 dev_id;
+	u32 arg;
+	u32 retval;
+	s32 err;
+};
+
+/* Ring of the last @size calls, @dropped counts those overwritten */
+struct armoury_wmi_trace {
+	spinlock_t lock;
+	u32 size;
+	u32 head;
+	u32 len;
+	u32 dropped;
+	struct armoury_wmi_trace_rec recs[];
+};
+
+/*
+ * Firmware access for an instance. The default goes to asus-wmi, other
+ * backends stand in for it when testing without the hardware. The semantics
+ * follow the asus-wmi functions of the same name.
+ */
+struct armoury_wmi_ops {
+	int (*evaluate_method)(struct asus_armoury_priv *priv, u32 method_id,
+			       u32 arg0, u32 arg1, u32 *retval);
+	int (*get_devstate)(struct asus_armoury_priv *priv, u32 dev_id, u32 *retval);
+	int (*set_devstate)(struct asus_armoury_priv *priv, u32 dev_id,
+			    u32 ctrl_param, u32 *retval);
+};
+
+/* Values firmware may change on its own, see armoury_watches[] */
+enum armoury_watch_idx {
+	ARMOURY_WATCH_EGPU_CONNECTED,
+	ARMOURY_WATCH_EGPU,
+	ARMOURY_WATCH_DGPU,
+	ARMOURY_WATCH_CHARGE_MODE,
+	ARMOURY_WATCH_COUNT,
+};
+
+/* Values that need a reboot, in the order they are committed, see armoury_stage_store() */
+enum armoury_stage_idx {
+	ARMOURY_STAGE_APU_MEM,
+	ARMOURY_STAGE_CORES,
+	ARMOURY_STAGE_PANEL_HD,
+	ARMOURY_STAGE_GPU_MUX,
+	ARMOURY_STAGE_COUNT,
+};
+
+/* Per-instance state, one for each bound WMI device or mock */
 struct asus_armoury_priv {
+	struct wmi_device *wdev;
+	int id;
+
+	const struct armoury_wmi_ops *wmi_ops;
+	void *wmi_data;
+	struct armoury_wmi_trace *wmi_trace;
+
+	/* Read-only page mapped through the misc device, see armoury_state_update() */
+	struct armoury_state_page *state;
+	spinlock_t state_lock;
+	struct miscdevice miscdev;
+	struct armoury_chardev *chardev;
+
 	struct device *fw_attr_dev;
 	struct kset *fw_attr_kset;
 
-	struct rog_tunables *rog_tunables;
+	/* Never changed in place, see armoury_tunables_store() */
+	struct rog_tunables __rcu *rog_tunables;
 	u32 mini_led_dev_id;
 	u32 gpu_mux_dev_id;
+	bool pending_reboot;
+
+	/* platform_profile handler, only while a profile is bound to a level */
+	struct device *ppdev;
+	enum platform_profile_option platform_profile;
+	struct list_head pp_node;
+
+	/* Tunables set away from their default, restored after resume */
+	unsigned long tunables_dirty;
+	struct work_struct restore_work;
+	u64 restore_us;
+	u32 restore_writes;
+
+	/* Completed once the boot profile blob is applied or found missing */
+	struct completion blob_done;
+
+	/* Tunable stores held back by write coalescing, see armoury_coalesce_store() */
+	struct armoury_tx *coalesce;
+	spinlock_t coalesce_lock;
+	unsigned long coalesce_since;
+	struct delayed_work coalesce_work;
+
+	/* Stores run from a workqueue with async_stores, see armoury_async_submit() */
+	struct workqueue_struct *async_wq;
+	struct armoury_async_slot *async_slots;
+	int async_count;
+	spinlock_t async_lock;
+	bool async_closing;
+
+	/* Raw values staged for the next reboot with stage_reboot, under mutex */
+	bool staging;
+	unsigned long staged;
+	u32 staged_value[ARMOURY_STAGE_COUNT];
+	struct notifier_block reboot_nb;
+
+	/* Watched values to read again, and those last read */
+	unsigned long watch_pending;
+	unsigned long watch_valid;
+	u32 watch_value[ARMOURY_WATCH_COUNT];
+	struct work_struct event_work;
+	struct notifier_block event_nb;
+
+	struct armoury_devstate devstate[ARRAY_SIZE(armoury_devids)];
+	spinlock_t devstate_lock;
+	wait_queue_head_t devstate_wq;
+	bool cache_bypass;
+	struct armoury_stats __percpu *stats;
+
+	/* Cost of asus_armoury_add(), and the presence probes it evaluated */
+	u64 probe_us;
+	u32 probe_calls;
+
+	struct dentry *debugfs_root;
+
+	/* Set under mutex while snapshot_show() reads, see armoury_get_devstate() */
+	struct task_struct *snapshot_task;
 
 	struct mutex mutex;
 };
 
-static struct asus_armoury_priv asus_armoury = {
-	.mutex = __MUTEX_INITIALIZER(asus_armoury.mutex)
-};
+/*
+ * The first bound instance keeps the plain DRIVER_NAME for its class device,
+ * any others get a numeric suffix from this IDA.
+ */
+static DEFINE_IDA(armoury_ida);
 
-struct fw_attrs_group {
-	bool pending_reboot;
-};
+/* Instance 0, whose presence results are exported through presence_cache */
+static DEFINE_MUTEX(armoury_primary_lock);
+static struct asus_armoury_priv *armoury_primary;
 
-static struct fw_attrs_group fw_attrs = {
-	.pending_reboot = false,
-};
+/* All attributes live in the "attributes" kset below the class device */
+static struct asus_armoury_priv *armoury_priv(struct kobject *kobj)
+{
+	return dev_get_drvdata(kobj_to_dev(kobj->parent));
+}
 
 struct asus_attr_group {
 	const struct attribute_group *attr_group;
 	u32 wmi_devid;
 };
 
-static bool asus_wmi_is_present(u32 dev_id)
-{
-	u32 retval;
-	int status;
+/* WMI backends ***************************************************************/
 
-	status = asus_wmi_evaluate_method(ASUS_WMI_METHODID_DSTS, dev_id, 0, &retval);
-	pr_debug("%s called (0x%08x), retval: 0x%08x\n", __func__, dev_id, retval);
+static int armoury_asus_wmi_evaluate_method(struct asus_armoury_priv *priv,
+					    u32 method_id, u32 arg0, u32 arg1,
+					    u32 *retval)
+{
+	return asus_wmi_evaluate_method(method_id, arg0, arg1, retval);
+}
 
-	return status == 0 && (retval & ASUS_WMI_DSTS_PRESENCE_BIT);
+static int armoury_asus_wmi_get_devstate(struct asus_armoury_priv *priv,
+					 u32 dev_id, u32 *retval)
+{
+	return asus_wmi_get_devstate_dsts(dev_id, retval);
 }
 
-static void asus_set_reboot_and_signal_event(void)
+static int armoury_asus_wmi_set_devstate(struct asus_armoury_priv *priv,
+					 u32 dev_id, u32 ctrl_param, u32 *retval)
 {
-	fw_attrs.pending_reboot = true;
-	kobject_uevent(&asus_armoury.fw_attr_dev->kobj, KOBJ_CHANGE);
+	return asus_wmi_set_devstate(dev_id, ctrl_param, retval);
 }
 
-static ssize_t pending_reboot_show(struct kobject *kobj,
-					struct kobj_attribute *attr,
-					char *buf)
+static const struct armoury_wmi_ops armoury_asus_wmi_ops = {
+	.evaluate_method = armoury_asus_wmi_evaluate_method,
+	.get_devstate = armoury_asus_wmi_get_devstate,
+	.set_devstate = armoury_asus_wmi_set_devstate,
+};
+
+/* Call statistics ************************************************************/
+
+static int armoury_devid_index(u32 dev_id)
 {
-	return sysfs_emit(buf, "%d\n", fw_attrs.pending_reboot);
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		if (armoury_devids[i] == dev_id)
+			return i;
+	}
+
+	return -1;
 }
 
-static struct kobj_attribute pending_reboot = __ATTR_RO(pending_reboot);
+static unsigned int armoury_lat_bucket(u64 duration_ns)
+{
+	u64 us = div_u64(duration_ns, NSEC_PER_USEC);
 
-static bool asus_bios_requires_reboot(struct kobj_attribute *attr)
+	if (!us)
+		return 0;
+
+	return min_t(unsigned int, ilog2(us) + 1, ARMOURY_LAT_BUCKETS - 1);
+}
+
+static void armoury_stats_account(struct asus_armoury_priv *priv, u32 method_id,
+				  u32 dev_id, u32 retval, int err, u64 duration,
+				  u32 smis)
 {
-	return !strcmp(attr->attr.name, "gpu_mux_mode") ||
-		!strcmp(attr->attr.name, "cores_performance") ||
-		!strcmp(attr->attr.name, "cores_efficiency") ||
-		!strcmp(attr->attr.name, "panel_hd_mode");
+	int idx = armoury_devid_index(dev_id);
+
+	if (idx < 0)
+		return;
+
+	this_cpu_add(priv->stats->devid[idx].smis, smis);
+
+	if (method_id == ASUS_WMI_METHODID_DEVS) {
+		armoury_stat_inc(priv, idx, writes);
+		armoury_stat_inc(priv, idx, devs_lat[armoury_lat_bucket(duration)]);
+		if (!err && retval != 1)
+			armoury_stat_inc(priv, idx, bad_results);
+	} else {
+		armoury_stat_inc(priv, idx, reads);
+		armoury_stat_inc(priv, idx, dsts_lat[armoury_lat_bucket(duration)]);
+	}
+
+	if (err)
+		armoury_stat_inc(priv, idx, failures);
 }
 
-/**
- * attr_int_store() - Generic store function for use with most WMI functions.
- * @kobj: Pointer to the driver object.
- * @kobj_attribute: Pointer the the attribute calling this function.
- * @buf: The buffer to read from, this is parsed to `int` type.
- * @count:
- * @min: Minimum accepted value. Below this returns -EINVAL.
- * @max: Maximum accepted value. Above this returns -EINVAL.
- * @store_value: Pointer to where the parsed value should be stored.
- * @wmi_dev: The WMI function ID to use.
- *
- * The WMI functions available on most ASUS laptops return a 1 as "success", and
- * a 0 as failed. However some functions can return n > 1 for additional errors.
- * attr_int_store() currently treats all values which are not 1 as errors, ignoring
- * the possible differences in WMI error returns.
+/* Firmware call budget *******************************************************/
+
+/*
+ * Most WMI methods enter SMM, which stalls every CPU in the machine, so the
+ * budget is global rather than per instance. It is accounted in fixed windows
+ * of one second. Every call is charged when it is made, but calls are only
+ * held back where the driver enters: before a store and before a read that
+ * misses the cache. Once either limit is reached, those wait for the next
+ * window, or fail with -EBUSY under the reject policy. A store admitted this
+ * way may make all its calls under priv->mutex without waiting again, so a
+ * window can be overrun by the calls of one store. That covers transaction,
+ * apply_profile and profile_blob, each admitted once for all the values it
+ * writes, character device SETs, admitted per value as stores, and a
+ * snapshot, admitted once for its reads.
+ * Presence probes are always queued, as a rejected probe would hide the
+ * attribute until reload.
  *
- * Returns: Either count, or an error.
+ * These are not held back at all:
+ *  - commit and the staged writes at reboot, which must not be refused;
+ *  - the restore after resume and the boot profile blob, which no caller
+ *    waits for and which must not be dropped;
+ *  - a platform_profile switch, as the other handlers wait for ours;
+ *  - the write of coalesced stores, each already admitted when stored;
+ *  - the reads after a firmware event, and those of interlock checks.
  */
-static ssize_t attr_int_store(struct kobject *kobj,
-				struct kobj_attribute *attr,
-				const char *buf, size_t count,
-				u32 min, u32 max, u32 *store_value, u32 wmi_dev)
-{
-	u32 result, value;
-	int err;
+enum armoury_fw_budget_policy {
+	ARMOURY_FW_BUDGET_QUEUE,
+	ARMOURY_FW_BUDGET_REJECT,
+};
 
-	err = kstrtouint(buf, 10, &value);
-	if (err)
-		return err;
+static const char * const armoury_fw_budget_policies[] = {
+	[ARMOURY_FW_BUDGET_QUEUE] = "queue",
+	[ARMOURY_FW_BUDGET_REJECT] = "reject",
+};
 
-	if (value < min || value > max)
-		return -EINVAL;
+static unsigned int fw_budget_calls;
+module_param(fw_budget_calls, uint, 0644);
+MODULE_PARM_DESC(fw_budget_calls,
+		 "Max firmware calls per second over all instances (0 for no limit)");
 
-	err = asus_wmi_set_devstate(wmi_dev, value, &result);
-	if (err) {
-		pr_err("Failed to set %s: %d\n", attr->attr.name, err);
-		return err;
-	}
+static unsigned int fw_budget_stall_us;
+module_param(fw_budget_stall_us, uint, 0644);
+MODULE_PARM_DESC(fw_budget_stall_us,
+		 "Max us per second spent in firmware calls over all instances (0 for no limit)");
 
-	if (result != 1) {
-		pr_err("Failed to set %s (result): 0x%x\n", attr->attr.name, result);
-		return -EIO;
-	}
+static int fw_budget_policy = ARMOURY_FW_BUDGET_QUEUE;
 
-	if (store_value != NULL)
-		*store_value = value;
-	sysfs_notify(kobj, NULL, attr->attr.name);
+static int fw_budget_policy_set(const char *val, const struct kernel_param *kp)
+{
+	int policy = sysfs_match_string(armoury_fw_budget_policies, val);
 
-	if (asus_bios_requires_reboot(attr))
-		asus_set_reboot_and_signal_event();
+	if (policy < 0)
+		return policy;
 
-	return count;
+	WRITE_ONCE(fw_budget_policy, policy);
+	return 0;
 }
 
-/* Mini-LED mode **************************************************************/
-static ssize_t mini_led_mode_current_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+static int fw_budget_policy_get(char *buf, const struct kernel_param *kp)
 {
-	u32 value;
-	int err;
+	return sysfs_emit(buf, "%s\n",
+			  armoury_fw_budget_policies[READ_ONCE(fw_budget_policy)]);
+}
 
-	err = asus_wmi_get_devstate_dsts(asus_armoury.mini_led_dev_id, &value);
-	if (err)
-		return err;
+static const struct kernel_param_ops fw_budget_policy_ops = {
+	.set = fw_budget_policy_set,
+	.get = fw_budget_policy_get,
+};
+module_param_cb(fw_budget_policy, &fw_budget_policy_ops, NULL, 0644);
+MODULE_PARM_DESC(fw_budget_policy,
+		 "What to do with calls over budget: queue (default) or reject");
+
+static struct {
+	unsigned long window;
+	u32 window_calls;
+	u64 window_stall_us;
+
+	u64 calls;
+	u64 stall_us;
+	u64 smis;
+	u64 queued;
+	u64 rejected;
+} armoury_fw_budget;
+static DEFINE_SPINLOCK(armoury_fw_budget_lock);
+
+/* MSR_SMI_COUNT is only there on Intel */
+static bool armoury_smi_count_supported;
+
+/* Timing and SMI count of one firmware call, see armoury_fw_call_begin() */
+struct armoury_fw_call {
+	ktime_t start;
+	int cpu;
+	u64 smi_count;
+};
 
-	value &= ASUS_MINI_LED_MODE_MASK;
+static bool armoury_fw_budget_left(void)
+{
+	unsigned int max_calls = READ_ONCE(fw_budget_calls);
+	unsigned int max_stall_us = READ_ONCE(fw_budget_stall_us);
 
-	/*
-	 * Remap the mode values to match previous generation mini-LED. The last gen
-	 * WMI 0 == off, while on this version WMI 2 == off (flipped).
-	 */
-	if (asus_armoury.mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2) {
-		switch (value) {
-		case ASUS_MINI_LED_2024_WEAK:
-			value = ASUS_MINI_LED_ON;
-			break;
-		case ASUS_MINI_LED_2024_STRONG:
-			value = ASUS_MINI_LED_STRONG_MODE;
-			break;
-		case ASUS_MINI_LED_2024_OFF:
-			value = ASUS_MINI_LED_OFF;
-			break;
-		}
+	if (time_after_eq(jiffies, armoury_fw_budget.window + HZ)) {
+		armoury_fw_budget.window = jiffies;
+		armoury_fw_budget.window_calls = 0;
+		armoury_fw_budget.window_stall_us = 0;
 	}
 
-	return sysfs_emit(buf, "%u\n", value);
+	return (!max_calls || armoury_fw_budget.window_calls < max_calls) &&
+	       (!max_stall_us || armoury_fw_budget.window_stall_us < max_stall_us);
 }
 
-static ssize_t mini_led_mode_current_value_store(struct kobject *kobj,
-						struct kobj_attribute *attr,
-						const char *buf, size_t count)
+static int armoury_fw_budget_take(bool may_reject)
 {
-	int result, err;
-	u32 mode;
-
-	err = kstrtou32(buf, 10, &mode);
-	if (err)
-		return err;
-
-	if (asus_armoury.mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE &&
-	    mode > ASUS_MINI_LED_ON)
-		return -EINVAL;
-	if (asus_armoury.mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2 &&
-	    mode > ASUS_MINI_LED_STRONG_MODE)
-		return -EINVAL;
+	bool queued = false;
+	long timeout;
+
+	for (;;) {
+		spin_lock(&armoury_fw_budget_lock);
+		if (armoury_fw_budget_left()) {
+			spin_unlock(&armoury_fw_budget_lock);
+			return 0;
+		}
 
-	/*
-	 * Remap the mode values so expected behaviour is the same as the last
-	 * generation of mini-LED with 0 == off, 1 == on.
-	 */
-	if (asus_armoury.mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2) {
-		switch (mode) {
-		case ASUS_MINI_LED_OFF:
-			mode = ASUS_MINI_LED_2024_OFF;
-			break;
-		case ASUS_MINI_LED_ON:
-			mode = ASUS_MINI_LED_2024_WEAK;
-			break;
-		case ASUS_MINI_LED_STRONG_MODE:
-			mode = ASUS_MINI_LED_2024_STRONG;
-			break;
+		if (may_reject && READ_ONCE(fw_budget_policy) == ARMOURY_FW_BUDGET_REJECT) {
+			armoury_fw_budget.rejected++;
+			spin_unlock(&armoury_fw_budget_lock);
+			return -EBUSY;
 		}
-	}
 
-	err = asus_wmi_set_devstate(asus_armoury.mini_led_dev_id, mode, &result);
-	if (err) {
-		pr_warn("Failed to set mini-LED: %d\n", err);
-		return err;
-	}
+		if (!queued)
+			armoury_fw_budget.queued++;
+		queued = true;
+		timeout = armoury_fw_budget.window + HZ - jiffies;
+		spin_unlock(&armoury_fw_budget_lock);
 
-	if (result != 1) {
-		pr_warn("Failed to set mini-LED mode (result): 0x%x\n", result);
-		return -EIO;
+		schedule_timeout_killable(max(timeout, 1L));
+		if (fatal_signal_pending(current))
+			return -EINTR;
 	}
+}
 
-	sysfs_notify(kobj, NULL, attr->attr.name);
+static void armoury_fw_call_begin(struct armoury_fw_call *call)
+{
+	call->cpu = -1;
+	if (armoury_smi_count_supported) {
+		call->cpu = get_cpu();
+		if (rdmsrl_safe(MSR_SMI_COUNT, &call->smi_count))
+			call->cpu = -1;
+		put_cpu();
+	}
 
-	return count;
+	call->start = ktime_get();
 }
 
-static ssize_t mini_led_mode_possible_values_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+/*
+ * Charges the call to the budget. Returns its duration in ns and the number
+ * of SMIs seen while it ran, which is 0 if the task moved to another CPU.
+ */
+static u64 armoury_fw_call_end(struct armoury_fw_call *call, u32 *smis)
 {
-	switch (asus_armoury.mini_led_dev_id) {
-	case ASUS_WMI_DEVID_MINI_LED_MODE:
-		return sysfs_emit(buf, "0;1\n");
-	case ASUS_WMI_DEVID_MINI_LED_MODE2:
-		return sysfs_emit(buf, "0;1;2\n");
+	u64 duration = ktime_to_ns(ktime_sub(ktime_get(), call->start));
+	u64 smi_count;
+
+	*smis = 0;
+	if (call->cpu >= 0) {
+		if (get_cpu() == call->cpu &&
+		    !rdmsrl_safe(MSR_SMI_COUNT, &smi_count))
+			*smis = smi_count - call->smi_count;
+		put_cpu();
 	}
 
-	return sysfs_emit(buf, "0\n");
-}
+	spin_lock(&armoury_fw_budget_lock);
+	armoury_fw_budget.window_calls++;
+	armoury_fw_budget.window_stall_us += div_u64(duration, NSEC_PER_USEC);
+	armoury_fw_budget.stall_us += div_u64(duration, NSEC_PER_USEC);
+	armoury_fw_budget.calls++;
+	armoury_fw_budget.smis += *smis;
+	spin_unlock(&armoury_fw_budget_lock);
 
-ATTR_GROUP_ENUM_CUSTOM(mini_led_mode, "mini_led_mode", "Set the mini-LED backlight mode");
+	return duration;
+}
 
-static ssize_t gpu_mux_mode_current_value_store(struct kobject *kobj,
-				struct kobj_attribute *attr,
-				const char *buf, size_t count)
+static void armoury_fw_budget_init(void)
 {
-	int result, err;
-	u32 optimus;
+	u64 smi_count;
 
-	err = kstrtou32(buf, 10, &optimus);
-	if (err)
-		return err;
+	armoury_fw_budget.window = jiffies;
+	armoury_smi_count_supported = boot_cpu_data.x86_vendor == X86_VENDOR_INTEL &&
+				      !rdmsrl_safe(MSR_SMI_COUNT, &smi_count);
+}
 
-	if (optimus > 1)
-		return -EINVAL;
+/* WMI call trace *************************************************************/
 
-	if (asus_wmi_is_present(ASUS_WMI_DEVID_DGPU)) {
-		err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_DGPU, &result);
-		if (err)
-			return err;
-		if (result && !optimus) {
-			err = -ENODEV;
-			pr_warn("Can not switch MUX to dGPU mode when dGPU is disabled: %02X %02X %d\n", result, optimus, err);
-			return err;
-		}
-	}
+static struct armoury_wmi_trace *armoury_wmi_trace_alloc(unsigned int entries)
+{
+	struct armoury_wmi_trace *trace;
 
-	if (asus_wmi_is_present(ASUS_WMI_DEVID_EGPU)) {
-		err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_EGPU, &result);
-		if (err)
-			return err;
-		if (result && !optimus) {
-			err = -ENODEV;
-			pr_warn("Can not switch MUX to dGPU mode when eGPU is enabled: %d\n", err);
-			return err;
-		}
-	}
+	entries = min_t(unsigned int, entries, ARMOURY_WMI_TRACE_MAX);
+	trace = kvzalloc(struct_size(trace, recs, entries), GFP_KERNEL);
+	if (!trace)
+		return NULL;
 
-	err = asus_wmi_set_devstate(asus_armoury.gpu_mux_dev_id, optimus, &result);
-	if (err) {
-		pr_err("Failed to set GPU MUX mode: %d\n", err);
-		return err;
-	}
-	/* !1 is considered a fail by ASUS */
-	if (result != 1) {
-		pr_warn("Failed to set GPU MUX mode (result): 0x%x\n", result);
-		return -EIO;
-	}
+	spin_lock_init(&trace->lock);
+	trace->size = entries;
 
-	sysfs_notify(kobj, NULL, attr->attr.name);
-	asus_set_reboot_and_signal_event();
+	return trace;
+}
 
-	return count;
+/*
+ * Accounts the call in the statistics, emits the wmi_call tracepoint and adds
+ * the call to the wmi_trace ring if that is in use.
+ */
+static void armoury_wmi_call_done(struct asus_armoury_priv *priv,
+				  struct armoury_fw_call *call, u32 method_id,
+				  u32 dev_id, u32 arg, u32 retval, int err)
+{
+	struct armoury_wmi_trace *trace = priv->wmi_trace;
+	struct armoury_wmi_trace_rec *rec;
+	u64 duration;
+	u32 smis;
+
+	duration = armoury_fw_call_end(call, &smis);
+	armoury_stats_account(priv, method_id, dev_id, retval, err, duration,
+			      smis);
+	trace_asus_armoury_wmi_call(priv->id, method_id, dev_id, arg, retval,
+				    err, duration, smis);
+	if (!trace)
+		return;
+
+	spin_lock(&trace->lock);
+	rec = &trace->recs[trace->head];
+	rec->start_ns = ktime_to_ns(call->start);
+	rec->duration_ns = min_t(u64, duration, U32_MAX);
+	rec->method_id = method_id;
+	rec->dev_id = dev_id;
+	rec->arg = arg;
+	rec->retval = retval;
+	rec->err = err;
+
+	trace->head = (trace->head + 1) % trace->size;
+	if (trace->len < trace->size)
+		trace->len++;
+	else
+		trace->dropped++;
+	spin_unlock(&trace->lock);
 }
-WMI_SHOW_INT(gpu_mux_mode_current_value, "%d\n", asus_armoury.gpu_mux_dev_id);
-ATTR_GROUP_BOOL_CUSTOM(gpu_mux_mode, "gpu_mux_mode", "Set the GPU display MUX mode");
 
 /*
- * A user may be required to store the value twice, typical store first, then
- * rescan PCI bus to activate power, then store a second time to save correctly.
- * The reason for this is that an extra code path in the ACPI is enabled when
- * the device and bus are powered.
+ * All firmware calls of the driver go through these, so that each one is
+ * charged to the budget and can be traced. Only presence probes use
+ * evaluate_method, those are never rejected. Reads wait for the budget if
+ * @admit, which callers under priv->mutex leave false. Writes never wait,
+ * armoury_attr_store() did before the store took the mutex.
  */
-static ssize_t dgpu_disable_current_value_store(struct kobject *kobj,
-				struct kobj_attribute *attr,
-				const char *buf, size_t count)
+static int armoury_wmi_evaluate_method(struct asus_armoury_priv *priv,
+				       u32 method_id, u32 arg0, u32 arg1,
+				       u32 *retval)
 {
-	int result, err;
-	u32 disable;
+	struct armoury_fw_call call;
+	int err;
 
-	err = kstrtou32(buf, 10, &disable);
+	err = armoury_fw_budget_take(false);
 	if (err)
 		return err;
 
-	if (disable > 1)
-		return -EINVAL;
+	armoury_fw_call_begin(&call);
+	err = priv->wmi_ops->evaluate_method(priv, method_id, arg0, arg1, retval);
+	armoury_wmi_call_done(priv, &call, method_id, arg0, arg1,
+			      err ? 0 : *retval, err);
 
-	if (asus_armoury.gpu_mux_dev_id) {
-		err = asus_wmi_get_devstate_dsts(asus_armoury.gpu_mux_dev_id, &result);
-		if (err)
-			return err;
-		if (!result && disable) {
-			err = -ENODEV;
-			pr_warn("Can not disable dGPU when the MUX is in dGPU mode: %d\n", err);
-			return err;
-		}
-	}
+	return err;
+}
 
-	err = asus_wmi_set_devstate(ASUS_WMI_DEVID_DGPU, disable, &result);
-	if (err) {
-		pr_warn("Failed to set dGPU disable: %d\n", err);
-		return err;
-	}
+static int armoury_wmi_get_devstate(struct asus_armoury_priv *priv, u32 dev_id,
+				    u32 *retval, bool admit)
+{
+	struct armoury_fw_call call;
+	int err;
 
-	if (result != 1) {
-		pr_warn("Failed to set dGPU disable (result): 0x%x\n", result);
-		return -EIO;
+	if (admit) {
+		err = armoury_fw_budget_take(true);
+		if (err)
+			return err;
 	}
 
-	sysfs_notify(kobj, NULL, attr->attr.name);
+	armoury_fw_call_begin(&call);
+	err = priv->wmi_ops->get_devstate(priv, dev_id, retval);
+	armoury_wmi_call_done(priv, &call, ASUS_WMI_METHODID_DSTS, dev_id, 0,
+			      err ? 0 : *retval, err);
 
-	return count;
+	return err;
 }
-WMI_SHOW_INT(dgpu_disable_current_value, "%d\n", ASUS_WMI_DEVID_DGPU);
-ATTR_GROUP_BOOL_CUSTOM(dgpu_disable, "dgpu_disable", "Disable the dGPU");
 
-/* The ACPI call to enable the eGPU also disables the internal dGPU */
-static ssize_t egpu_enable_current_value_store(struct kobject *kobj,
-				struct kobj_attribute *attr,
-				const char *buf, size_t count)
+static int armoury_wmi_set_devstate(struct asus_armoury_priv *priv, u32 dev_id,
+				    u32 ctrl_param, u32 *retval)
 {
-	int result, err;
-	u32 enable;
+	struct armoury_fw_call call;
+	int err;
 
-	err = kstrtou32(buf, 10, &enable);
-	if (err)
-		return err;
+	armoury_fw_call_begin(&call);
+	err = priv->wmi_ops->set_devstate(priv, dev_id, ctrl_param, retval);
+	armoury_wmi_call_done(priv, &call, ASUS_WMI_METHODID_DEVS, dev_id,
+			      ctrl_param, err ? 0 : *retval, err);
 
-	if (enable > 1)
-		return -EINVAL;
+	return err;
+}
 
-	err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_EGPU_CONNECTED, &result);
-	if (err) {
-		pr_warn("Failed to get eGPU connection status: %d\n", err);
-		return err;
-	}
+/* Shared state page **********************************************************/
 
-	if (asus_armoury.gpu_mux_dev_id) {
-		err = asus_wmi_get_devstate_dsts(asus_armoury.gpu_mux_dev_id, &result);
-		if (err) {
-			pr_warn("Failed to get GPU MUX status: %d\n", result);
-			return result;
-		}
-		if (!result && enable) {
-			err = -ENODEV;
-			pr_warn("Can not enable eGPU when the MUX is in dGPU mode: %d\n", err);
-			return err;
-		}
-	}
+/*
+ * The page layout, struct armoury_state_page, is in asus-armoury-ioctl.h. Its
+ * entries follow armoury_devids[], the tunables show their tunable value.
+ */
+static struct armoury_state_page *armoury_state_begin(struct asus_armoury_priv *priv)
+{
+	struct armoury_state_page *state = priv->state;
 
-	err = asus_wmi_set_devstate(ASUS_WMI_DEVID_EGPU, enable, &result);
-	if (err) {
-		pr_warn("Failed to set eGPU state: %d\n", err);
-		return err;
-	}
+	spin_lock(&priv->state_lock);
+	WRITE_ONCE(state->seq, state->seq + 1);
+	smp_wmb();
 
-	if (result != 1) {
-		pr_warn("Failed to set eGPU state (retval): 0x%x\n", result);
-		return -EIO;
-	}
+	return state;
+}
 
-	sysfs_notify(kobj, NULL, attr->attr.name);
+static void armoury_state_end(struct asus_armoury_priv *priv)
+{
+	struct armoury_state_page *state = priv->state;
 
-	return count;
+	smp_wmb();
+	WRITE_ONCE(state->seq, state->seq + 1);
+	spin_unlock(&priv->state_lock);
 }
-WMI_SHOW_INT(egpu_enable_current_value, "%d\n", ASUS_WMI_DEVID_EGPU);
-ATTR_GROUP_BOOL_CUSTOM(egpu_enable, "egpu_enable", "Enable the eGPU (also disables dGPU)");
-
-/* Device memory available to APU */
 
-static ssize_t apu_mem_current_value_show(struct kobject *kobj,
-				struct kobj_attribute *attr, char *buf)
+/* Publishes @value for @dev_id, the generation only moves if it changed */
+static void armoury_state_update(struct asus_armoury_priv *priv, u32 dev_id,
+				 u32 value)
 {
-	int err;
-	u32 mem;
+	int idx = armoury_devid_index(dev_id);
+	struct armoury_state_page *state;
+
+	if (idx < 0 || !priv->state)
+		return;
+
+	value &= ~ASUS_WMI_DSTS_PRESENCE_BIT;
+	if (READ_ONCE(priv->state->value[idx]) == value &&
+	    (READ_ONCE(priv->state->valid) & BIT_ULL(idx)))
+		return;
+
+	state = armoury_state_begin(priv);
+	state->value[idx] = value;
+	state->valid |= BIT_ULL(idx);
+	state->gen[idx] = ++state->generation;
+	armoury_state_end(priv);
+}
 
-	err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_APU_MEM, &mem);
-	if (err)
-		return err;
+static void armoury_state_set_reboot(struct asus_armoury_priv *priv)
+{
+	struct armoury_state_page *state;
 
-	switch (mem) {
-	case 256:
-		mem = 0;
-		break;
-	case 258:
-		mem = 1;
-		break;
-	case 259:
-		mem = 2;
-		break;
-	case 260:
-		mem = 3;
-		break;
-	case 261:
-		mem = 4;
-		break;
-	case 262:
-		/* This is out of order and looks wrong but is correct */
-		mem = 8;
-		break;
-	case 263:
-		mem = 5;
-		break;
-	case 264:
-		mem = 6;
-		break;
-	case 265:
-		mem = 7;
-		break;
-	default:
-		mem = 4;
-		break;
-	}
+	if (!priv->state || priv->state->pending_reboot)
+		return;
 
-	return sysfs_emit(buf, "%u\n", mem);
+	state = armoury_state_begin(priv);
+	state->pending_reboot = 1;
+	state->generation++;
+	armoury_state_end(priv);
 }
 
-static ssize_t apu_mem_current_value_store(struct kobject *kobj,
-				struct kobj_attribute *attr,
-				const char *buf, size_t count)
+static struct armoury_state_page *armoury_state_alloc(void)
 {
-	int result, err;
-	u32 requested, mem;
+	struct armoury_state_page *state;
 
-	result = kstrtou32(buf, 10, &requested);
-	if (result)
-		return result;
+	BUILD_BUG_ON(sizeof(*state) > PAGE_SIZE);
+	BUILD_BUG_ON(ARRAY_SIZE(armoury_devids) > ARMOURY_STATE_MAX_ENTRIES);
 
-	switch (requested) {
-	case 0:
-		mem = 0;
-		break;
-	case 1:
-		mem = 258;
-		break;
-	case 2:
-		mem = 259;
-		break;
-	case 3:
-		mem = 260;
-		break;
-	case 4:
-		mem = 261;
-		break;
-	case 5:
-		mem = 263;
-		break;
-	case 6:
-		mem = 264;
-		break;
-	case 7:
-		mem = 265;
-		break;
-	case 8:
-		/* This is out of order and looks wrong but is correct */
-		mem = 262;
-		break;
-	default:
-		return -EIO;
-	}
+	state = (struct armoury_state_page *)get_zeroed_page(GFP_KERNEL);
+	if (!state)
+		return NULL;
 
-	err = asus_wmi_set_devstate(ASUS_WMI_DEVID_APU_MEM, mem, &result);
-	if (err) {
-		pr_warn("Failed to set apu_mem: %d\n", err);
-		return err;
-	}
+	state->magic = ARMOURY_STATE_MAGIC;
+	state->version = ARMOURY_STATE_VERSION;
+	state->count = ARRAY_SIZE(armoury_devids);
+	memcpy(state->dev_id, armoury_devids, sizeof(armoury_devids));
 
-	pr_info("APU memory changed to %uGB, reboot required\n", requested);
-	sysfs_notify(kobj, NULL, attr->attr.name);
+	return state;
+}
 
-	asus_set_reboot_and_signal_event();
+/* WMI devstate cache *********************************************************/
 
-	return count;
+static struct armoury_devstate *armoury_devstate_find(struct asus_armoury_priv *priv,
+						      u32 dev_id)
+{
+	int idx = armoury_devid_index(dev_id);
+
+	return idx < 0 ? NULL : &priv->devstate[idx];
 }
 
-static ssize_t apu_mem_possible_values_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+static void armoury_devstate_invalidate(struct asus_armoury_priv *priv, u32 dev_id)
 {
-	return sysfs_emit(buf, "0;1;2;3;4;5;6;7;8\n");
+	struct armoury_devstate *state = armoury_devstate_find(priv, dev_id);
+
+	if (!state)
+		return;
+
+	spin_lock(&priv->devstate_lock);
+	state->valid = false;
+	state->gen++;
+	spin_unlock(&priv->devstate_lock);
 }
-ATTR_GROUP_ENUM_CUSTOM(apu_mem, "apu_mem", "Set the available system memory for the APU to use");
 
-static int init_max_cpu_cores(void)
+static void armoury_devstate_invalidate_all(struct asus_armoury_priv *priv)
 {
-	u32 cores;
+	spin_lock(&priv->devstate_lock);
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		priv->devstate[i].valid = false;
+		priv->devstate[i].gen++;
+	}
+	spin_unlock(&priv->devstate_lock);
+}
+
+static bool armoury_devstate_flight_done(struct asus_armoury_priv *priv,
+					 struct armoury_devstate *state,
+					 unsigned int seq)
+{
+	bool done;
+
+	spin_lock(&priv->devstate_lock);
+	done = state->flight_seq != seq;
+	spin_unlock(&priv->devstate_lock);
+
+	return done;
+}
+
+/**
+ * __armoury_get_devstate() - Cached variant of asus_wmi_get_devstate_dsts().
+ * @priv: The driver instance.
+ * @dev_id: The WMI function ID to read.
+ * @retval: Where to store the result, including the presence bit.
+ * @admit: Whether a miss waits for the firmware call budget.
+ *
+ * Serves the value from the devstate cache if it is younger than
+ * cache_max_age_ms, otherwise evaluates DSTS and refreshes the cache. Entries
+ * are dropped by our own stores and by firmware events. The cache is skipped
+ * entirely if cache_max_age_ms is 0 or cache_bypass is set in debugfs.
+ *
+ * Concurrent misses on the same device ID are coalesced into one evaluation,
+ * whether or not the cache is in use.
+ *
+ * Returns: 0 on success, or the error from asus_wmi_get_devstate_dsts().
+ */
+static int __armoury_get_devstate(struct asus_armoury_priv *priv, u32 dev_id,
+				  u32 *retval, bool admit)
+{
+	struct armoury_devstate *state;
+	unsigned int max_age, gen, seq;
+	bool use_cache, joined;
+	u32 value;
 	int err;
 
-	asus_armoury.rog_tunables->min_perf_cores = 4;
-	asus_armoury.rog_tunables->max_perf_cores = 4;
-	asus_armoury.rog_tunables->cur_perf_cores = 4;
-	asus_armoury.rog_tunables->min_power_cores = 0;
-	asus_armoury.rog_tunables->max_power_cores = 8;
-	asus_armoury.rog_tunables->cur_power_cores = 8;
+	state = armoury_devstate_find(priv, dev_id);
+	if (!state)
+		return armoury_wmi_get_devstate(priv, dev_id, retval, admit);
+
+	max_age = READ_ONCE(cache_max_age_ms);
+	use_cache = max_age && !READ_ONCE(priv->cache_bypass);
+
+	spin_lock(&priv->devstate_lock);
+	for (;;) {
+		if (!use_cache) {
+			state->valid = false;
+		} else if (state->valid && time_before(jiffies, state->expires)) {
+			*retval = state->value;
+			spin_unlock(&priv->devstate_lock);
+			armoury_stat_inc(priv, state - priv->devstate, cache_hits);
+			return 0;
+		}
 
-	err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_CORES_MAX, &cores);
-	if (err)
-		return err;
+		if (!state->busy)
+			break;
 
-	cores &= ~ASUS_WMI_DSTS_PRESENCE_BIT;
-	asus_armoury.rog_tunables->max_power_cores = FIELD_GET(ASUS_POWER_CORE_MASK, cores);
-	asus_armoury.rog_tunables->max_perf_cores = FIELD_GET(ASUS_PERF_CORE_MASK, cores);
+		/*
+		 * An evaluation started before the last invalidation may return
+		 * the old state, so wait it out and then run our own.
+		 */
+		seq = state->flight_seq;
+		joined = state->flight_gen == state->gen;
+		if (joined)
+			armoury_stat_inc(priv, state - priv->devstate, coalesced);
+		spin_unlock(&priv->devstate_lock);
+
+		wait_event(priv->devstate_wq,
+			   armoury_devstate_flight_done(priv, state, seq));
+
+		spin_lock(&priv->devstate_lock);
+		if (joined) {
+			err = state->flight_err;
+			value = state->flight_value;
+			spin_unlock(&priv->devstate_lock);
+			goto out;
+		}
+	}
+	state->busy = true;
+	state->flight_gen = gen = state->gen;
+	spin_unlock(&priv->devstate_lock);
+
+	err = armoury_wmi_get_devstate(priv, dev_id, &value, admit);
+
+	spin_lock(&priv->devstate_lock);
+	state->busy = false;
+	state->flight_seq++;
+	state->flight_err = err;
+	state->flight_value = value;
+	if (!err && use_cache && state->gen == gen) {
+		state->value = value;
+		state->expires = jiffies + msecs_to_jiffies(max_age);
+		state->valid = true;
+	}
+	spin_unlock(&priv->devstate_lock);
+	wake_up_all(&priv->devstate_wq);
 
-	cores = 0;
-	err = asus_wmi_get_devstate_dsts(ASUS_WMI_DEVID_CORES, &cores);
+out:
 	if (err)
 		return err;
 
-	asus_armoury.rog_tunables->cur_perf_cores = FIELD_GET(ASUS_PERF_CORE_MASK, cores);
-	asus_armoury.rog_tunables->cur_power_cores = FIELD_GET(ASUS_POWER_CORE_MASK, cores);
-
+	armoury_state_update(priv, dev_id, value);
+	*retval = value;
 	return 0;
 }
 
-static ssize_t cores_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf,
-					enum cpu_core_type core_type,
-					enum cpu_core_value core_value)
+/*
+ * Reads made by the shows of a snapshot do not wait for the budget again, it
+ * was admitted once before it took priv->mutex.
+ */
+static int armoury_get_devstate(struct asus_armoury_priv *priv, u32 dev_id, u32 *retval)
 {
-	u32 cores;
-
-	switch (core_value) {
-	case CPU_CORE_DEFAULT:
-	case CPU_CORE_MAX:
-		if (core_type == CPU_CORE_PERF)
-			return sysfs_emit(buf, "%d\n", asus_armoury.rog_tunables->max_perf_cores);
-		else
-			return sysfs_emit(buf, "%d\n", asus_armoury.rog_tunables->max_power_cores);
-	case CPU_CORE_MIN:
-		if (core_type == CPU_CORE_PERF)
-			return sysfs_emit(buf, "%d\n", asus_armoury.rog_tunables->min_perf_cores);
-		else
-			return sysfs_emit(buf, "%d\n", asus_armoury.rog_tunables->min_power_cores);
-	default:
-		break;
-	}
-
-	if (core_type == CPU_CORE_PERF)
-		cores = asus_armoury.rog_tunables->cur_perf_cores;
-	else
-		cores = asus_armoury.rog_tunables->cur_power_cores;
-
-	return sysfs_emit(buf, "%d\n", cores);
+	return __armoury_get_devstate(priv, dev_id, retval,
+				      READ_ONCE(priv->snapshot_task) != current);
 }
 
-static ssize_t cores_current_value_store(struct kobject *kobj,
-				struct kobj_attribute *attr, const char *buf,
-				enum cpu_core_type core_type)
+/*
+ * As armoury_get_devstate(), but always evaluates DSTS. Interlock checks use
+ * this, a cached value may predate a change firmware made on its own. They
+ * run in a store already admitted against the budget, or in a commit that is
+ * not held back, so the read does not wait for the budget again.
+ */
+static int armoury_get_devstate_uncached(struct asus_armoury_priv *priv, u32 dev_id,
+					 u32 *retval)
 {
-	int result, err;
-	u32 new_cores, perf_cores, powr_cores, out_val, min, max;
+	armoury_devstate_invalidate(priv, dev_id);
+	return __armoury_get_devstate(priv, dev_id, retval, false);
+}
 
-	result = kstrtou32(buf, 10, &new_cores);
-	if (result)
-		return result;
+/* Presence probing ***********************************************************/
 
-	if (core_type == CPU_CORE_PERF) {
-		perf_cores = new_cores;
-		powr_cores = out_val = asus_armoury.rog_tunables->cur_power_cores;
-		min = asus_armoury.rog_tunables->min_perf_cores;
-		max = asus_armoury.rog_tunables->max_perf_cores;
-	} else {
-		perf_cores = asus_armoury.rog_tunables->cur_perf_cores;
-		powr_cores = out_val = new_cores;
-		min = asus_armoury.rog_tunables->min_power_cores;
-		max = asus_armoury.rog_tunables->max_power_cores;
-	}
+/*
+ * Presence results may be handed back in at load time through the
+ * presence_cache module parameter, formatted as "key:probed:present". The key
+ * is a CRC of the DMI product name, BIOS version and armoury_devids, and the
+ * two bitmaps are indexed by armoury_devids. A stale or foreign value is
+ * ignored and everything is probed as usual.
+ */
+static u32 presence_cache_key;
+static u64 presence_cache_probed;
+static u64 presence_cache_present;
 
-	if (new_cores < min || new_cores > max)
-		return -EINVAL;
+static u32 armoury_presence_key(void)
+{
+	const char *product = dmi_get_system_info(DMI_PRODUCT_NAME);
+	const char *bios = dmi_get_system_info(DMI_BIOS_VERSION);
+	u32 key = ~0;
 
-	out_val = 0;
-	out_val |= FIELD_PREP(ASUS_PERF_CORE_MASK, perf_cores);
-	out_val |= FIELD_PREP(ASUS_POWER_CORE_MASK, powr_cores);
+	if (product)
+		key = crc32(key, product, strlen(product) + 1);
+	if (bios)
+		key = crc32(key, bios, strlen(bios) + 1);
 
-	mutex_lock(&asus_armoury.mutex);
-	err = asus_wmi_set_devstate(ASUS_WMI_DEVID_CORES, out_val, &result);
-	mutex_unlock(&asus_armoury.mutex);
+	return crc32(key, armoury_devids, sizeof(armoury_devids));
+}
 
-	if (err) {
-		pr_warn("Failed to set CPU core count: %d\n", err);
-		return err;
-	}
+static int presence_cache_set(const char *val, const struct kernel_param *kp)
+{
+	u64 probed, present;
+	u32 key;
 
-	if (result > 1) {
-		pr_warn("Failed to set CPU core count (result): 0x%x\n", result);
-		return -EIO;
-	}
+	if (sscanf(val, "%x:%llx:%llx", &key, &probed, &present) != 3)
+		return -EINVAL;
 
-	pr_info("CPU core count changed, reboot required\n");
-	sysfs_notify(kobj, NULL, attr->attr.name);
-	asus_set_reboot_and_signal_event();
+	presence_cache_key = key;
+	presence_cache_probed = probed;
+	presence_cache_present = present & probed;
 
 	return 0;
 }
 
-static ssize_t cores_performance_min_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+static int presence_cache_get(char *buf, const struct kernel_param *kp)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_MIN);
-}
+	struct asus_armoury_priv *priv;
+	u64 probed = 0, present = 0;
+
+	mutex_lock(&armoury_primary_lock);
+	priv = armoury_primary;
+	if (priv) {
+		spin_lock(&priv->devstate_lock);
+		for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+			if (priv->devstate[i].probed)
+				probed |= BIT_ULL(i);
+			if (priv->devstate[i].present)
+				present |= BIT_ULL(i);
+		}
+		spin_unlock(&priv->devstate_lock);
+	}
+	mutex_unlock(&armoury_primary_lock);
 
-static ssize_t cores_performance_max_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
-{
-	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_MAX);
+	return sysfs_emit(buf, "%08x:%llx:%llx\n", armoury_presence_key(),
+			  probed, present);
 }
 
-static ssize_t cores_performance_default_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+static const struct kernel_param_ops presence_cache_ops = {
+	.set = presence_cache_set,
+	.get = presence_cache_get,
+};
+module_param_cb(presence_cache, &presence_cache_ops, NULL, 0444);
+MODULE_PARM_DESC(presence_cache,
+		 "Presence results of a previous load, to skip probing on the same model and BIOS");
+
+static void armoury_presence_seed(struct asus_armoury_priv *priv)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_DEFAULT);
-}
+	BUILD_BUG_ON(ARRAY_SIZE(armoury_devids) > 64);
 
-static ssize_t cores_performance_current_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+	if (!presence_cache_probed)
+		return;
+
+	if (presence_cache_key != armoury_presence_key()) {
+		pr_info("Ignoring presence_cache from another model or BIOS\n");
+		return;
+	}
+
+	spin_lock(&priv->devstate_lock);
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		if (!(presence_cache_probed & BIT_ULL(i)))
+			continue;
+		priv->devstate[i].probed = true;
+		priv->devstate[i].present = presence_cache_present & BIT_ULL(i);
+	}
+	spin_unlock(&priv->devstate_lock);
+}
+
+/*
+ * Each device ID is evaluated at most once per load, the result is kept in
+ * the devstate table for any later callers. Only answers from firmware are
+ * kept, a success or -ENODEV for a method it does not support. Other errors,
+ * such as an interrupted wait for the budget, are tried again on the next
+ * call and never end up in presence_cache.
+ */
+static bool asus_wmi_is_present(struct asus_armoury_priv *priv, u32 dev_id)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_CURRENT);
+	struct armoury_devstate *state = armoury_devstate_find(priv, dev_id);
+	bool present;
+	u32 retval;
+	int status;
+
+	if (state && READ_ONCE(state->probed))
+		return READ_ONCE(state->present);
+
+	status = armoury_wmi_evaluate_method(priv, ASUS_WMI_METHODID_DSTS,
+					     dev_id, 0, &retval);
+	priv->probe_calls++;
+	pr_debug("%s called (0x%08x), retval: 0x%08x\n", __func__, dev_id, retval);
+
+	present = status == 0 && (retval & ASUS_WMI_DSTS_PRESENCE_BIT);
+	if (state && (status == 0 || status == -ENODEV)) {
+		spin_lock(&priv->devstate_lock);
+		state->present = present;
+		state->probed = true;
+		spin_unlock(&priv->devstate_lock);
+	}
+
+	return present;
 }
 
-static ssize_t cores_performance_current_value_store(struct kobject *kobj,
+/* ROG tunables ***************************************************************/
+
+/*
+ * The limits and values of the ROG tunables are published with RCU. Readers
+ * get a consistent set without blocking, and writers hold priv->mutex to
+ * replace the whole set with an updated copy.
+ */
+static u32 *armoury_tunable_val(struct rog_tunables *rog, size_t offset)
+{
+	return (u32 *)((u8 *)rog + offset);
+}
+
+/* Reads the u32 at @offset of the published tunables */
+static u32 armoury_tunable_get(struct asus_armoury_priv *priv, size_t offset)
+{
+	u32 value;
+
+	rcu_read_lock();
+	value = *armoury_tunable_val(rcu_dereference(priv->rog_tunables), offset);
+	rcu_read_unlock();
+
+	return value;
+}
+
+static struct rog_tunables *armoury_tunables_locked(struct asus_armoury_priv *priv)
+{
+	return rcu_dereference_protected(priv->rog_tunables,
+					 lockdep_is_held(&priv->mutex));
+}
+
+/*
+ * Publishes a copy of the tunables with the u32 at @offset set to @value. This
+ * runs once firmware already has the value, so the copy is not allowed to fail.
+ */
+static void armoury_tunables_store(struct asus_armoury_priv *priv, size_t offset,
+				   u32 value)
+{
+	struct rog_tunables *old = armoury_tunables_locked(priv);
+	struct rog_tunables *new;
+
+	if (*armoury_tunable_val(old, offset) == value)
+		return;
+
+	new = kmemdup(old, sizeof(*old), GFP_KERNEL | __GFP_NOFAIL);
+	*armoury_tunable_val(new, offset) = value;
+	rcu_assign_pointer(priv->rog_tunables, new);
+	kfree_rcu(old, rcu);
+}
+
+/* WMI devstate write shadow **************************************************/
+
+/*
+ * Returns true and counts the skipped write if @value is what firmware was
+ * last successfully set to for @dev_id. Firmware may change a value without
+ * an event, such as on a platform_profile change, so as with the read cache
+ * a shadow is only trusted for cache_max_age_ms.
+ */
+static bool armoury_shadow_matches(struct asus_armoury_priv *priv, u32 dev_id, u32 value)
+{
+	struct armoury_devstate *state = armoury_devstate_find(priv, dev_id);
+	bool match;
+
+	if (!state || !READ_ONCE(write_elision))
+		return false;
+
+	spin_lock(&priv->devstate_lock);
+	match = state->shadow_valid && state->shadow == value &&
+		time_before(jiffies, state->shadow_expires);
+	if (match)
+		armoury_stat_inc(priv, state - priv->devstate, elided);
+	spin_unlock(&priv->devstate_lock);
+
+	return match;
+}
+
+static void armoury_shadow_update(struct asus_armoury_priv *priv, u32 dev_id,
+				  u32 value, bool valid)
+{
+	struct armoury_devstate *state = armoury_devstate_find(priv, dev_id);
+
+	if (!state)
+		return;
+
+	spin_lock(&priv->devstate_lock);
+	state->shadow = value;
+	state->shadow_valid = valid;
+	state->shadow_expires = jiffies + msecs_to_jiffies(READ_ONCE(cache_max_age_ms));
+	spin_unlock(&priv->devstate_lock);
+}
+
+static void armoury_shadow_invalidate_all(struct asus_armoury_priv *priv)
+{
+	spin_lock(&priv->devstate_lock);
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++)
+		priv->devstate[i].shadow_valid = false;
+	spin_unlock(&priv->devstate_lock);
+}
+
+/**
+ * armoury_set_devstate() - Write a WMI device state unless already in effect.
+ * @priv: The driver instance.
+ * @dev_id: The WMI function ID to write.
+ * @value: The raw value to write.
+ * @retval: Where to store the result of the WMI call.
+ *
+ * If @value matches the write shadow the firmware call is skipped. Otherwise
+ * the value is written, the read cache for @dev_id dropped, and the shadow
+ * updated if firmware reported success (@retval == 1). Writes are serialised
+ * on priv->mutex so the shadow follows the order firmware saw them in.
+ *
+ * Returns: 0 if written, -EALREADY if skipped, or the WMI error.
+ */
+static int __armoury_set_devstate(struct asus_armoury_priv *priv, u32 dev_id,
+				  u32 value, u32 *retval)
+{
+	int err;
+
+	lockdep_assert_held(&priv->mutex);
+
+	if (armoury_shadow_matches(priv, dev_id, value))
+		return -EALREADY;
+
+	err = armoury_wmi_set_devstate(priv, dev_id, value, retval);
+	armoury_devstate_invalidate(priv, dev_id);
+	armoury_shadow_update(priv, dev_id, value, !err && *retval == 1);
+	if (!err && *retval == 1)
+		armoury_state_update(priv, dev_id, value);
+
+	return err;
+}
+
+static int armoury_set_devstate(struct asus_armoury_priv *priv, u32 dev_id,
+				u32 value, u32 *retval)
+{
+	int err;
+
+	mutex_lock(&priv->mutex);
+	err = __armoury_set_devstate(priv, dev_id, value, retval);
+	mutex_unlock(&priv->mutex);
+
+	return err;
+}
+
+static void asus_set_reboot_and_signal_event(struct asus_armoury_priv *priv)
+{
+	if (!priv->pending_reboot)
+		trace_asus_armoury_pending_reboot(priv->id, true);
+	priv->pending_reboot = true;
+	armoury_state_set_reboot(priv);
+	kobject_uevent(&priv->fw_attr_dev->kobj, KOBJ_CHANGE);
+}
+
+static ssize_t pending_reboot_show(struct kobject *kobj,
 					struct kobj_attribute *attr,
-					const char *buf, size_t count)
+					char *buf)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+
+	return sysfs_emit(buf, "%d\n", priv->pending_reboot);
+}
+
+static struct kobj_attribute pending_reboot = __ATTR_RO(pending_reboot);
+
+/*
+ * Attributes sit in a named group directory, sysfs_notify() needs that to
+ * reach anyone polling the file.
+ */
+static void armoury_attr_notify(struct kobject *kobj, struct kobj_attribute *attr)
+{
+	trace_asus_armoury_sysfs_notify(armoury_priv(kobj)->id, attr);
+	sysfs_notify(kobj, armoury_attr_group_name(attr), attr->attr.name);
+}
+
+static bool asus_bios_requires_reboot(struct kobj_attribute *attr)
+{
+	const char *name = armoury_attr_group_name(attr);
+
+	if (!name)
+		return false;
+
+	return !strcmp(name, "gpu_mux_mode") ||
+		!strcmp(name, "cores_performance") ||
+		!strcmp(name, "cores_efficiency") ||
+		!strcmp(name, "panel_hd_mode");
+}
+
+static void armoury_tunables_mark(struct asus_armoury_priv *priv, u32 dev_id,
+				  u32 value);
+static bool armoury_coalesce_store(struct asus_armoury_priv *priv, u32 dev_id,
+				   u32 value);
+static void armoury_coalesce_flush(struct asus_armoury_priv *priv);
+static int armoury_stage_store(struct asus_armoury_priv *priv, u32 dev_id,
+			       u32 value, u32 mask);
+
+/**
+ * attr_int_store() - Generic store function for use with most WMI functions.
+ * @kobj: Pointer to the driver object.
+ * @kobj_attribute: Pointer the the attribute calling this function.
+ * @buf: The buffer to read from, this is parsed to `int` type.
+ * @count:
+ * @min: Minimum accepted value. Below this returns -EINVAL.
+ * @max: Maximum accepted value. Above this returns -EINVAL.
+ * @wmi_dev: The WMI function ID to use.
+ *
+ * The WMI functions available on most ASUS laptops return a 1 as "success", and
+ * a 0 as failed. However some functions can return n > 1 for additional errors.
+ * attr_int_store() currently treats all values which are not 1 as errors, ignoring
+ * the possible differences in WMI error returns.
+ *
+ * A value which firmware already has is accepted without calling WMI or
+ * notifying, see armoury_set_devstate(). With write coalescing enabled the
+ * tunables are only staged here, see armoury_coalesce_store(), and so are
+ * values that need a reboot with stage_reboot, see armoury_stage_store().
+ *
+ * Returns: Either count, or an error.
+ */
+static ssize_t attr_int_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count,
+				u32 min, u32 max, u32 wmi_dev)
 {
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	u32 result, value;
 	int err;
 
-	err = cores_current_value_store(kobj, attr, buf, CPU_CORE_PERF);
+	err = kstrtouint(buf, 10, &value);
 	if (err)
 		return err;
 
+	if (value < min || value > max)
+		return -EINVAL;
+
+	if (armoury_coalesce_store(priv, wmi_dev, value))
+		return count;
+
+	err = armoury_stage_store(priv, wmi_dev, value, ~0);
+	if (err)
+		return err < 0 ? err : count;
+
+	/* Tunables are published in the order firmware got them */
+	mutex_lock(&priv->mutex);
+	err = __armoury_set_devstate(priv, wmi_dev, value, &result);
+	if (err == -EALREADY || (!err && result == 1))
+		armoury_tunables_mark(priv, wmi_dev, value);
+	mutex_unlock(&priv->mutex);
+	if (err == -EALREADY)
+		return count;
+	if (err) {
+		pr_err("Failed to set %s: %d\n", attr->attr.name, err);
+		return err;
+	}
+
+	if (result != 1) {
+		pr_err("Failed to set %s (result): 0x%x\n", attr->attr.name, result);
+		return -EIO;
+	}
+
+	armoury_attr_notify(kobj, attr);
+
+	if (asus_bios_requires_reboot(attr))
+		asus_set_reboot_and_signal_event(priv);
+
 	return count;
 }
-ATTR_GROUP_CORES_RW(cores_performance, "cores_performance",
-		"Set the max available performance cores");
 
-static ssize_t cores_efficiency_min_value_show(struct kobject *kobj,
+/* Mini-LED mode **************************************************************/
+static ssize_t mini_led_mode_current_value_show(struct kobject *kobj,
 					struct kobj_attribute *attr, char *buf)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_MIN);
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	u32 value;
+	int err;
+
+	err = armoury_get_devstate(priv, priv->mini_led_dev_id, &value);
+	if (err)
+		return err;
+
+	value &= ASUS_MINI_LED_MODE_MASK;
+
+	/*
+	 * Remap the mode values to match previous generation mini-LED. The last gen
+	 * WMI 0 == off, while on this version WMI 2 == off (flipped).
+	 */
+	if (priv->mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2) {
+		switch (value) {
+		case ASUS_MINI_LED_2024_WEAK:
+			value = ASUS_MINI_LED_ON;
+			break;
+		case ASUS_MINI_LED_2024_STRONG:
+			value = ASUS_MINI_LED_STRONG_MODE;
+			break;
+		case ASUS_MINI_LED_2024_OFF:
+			value = ASUS_MINI_LED_OFF;
+			break;
+		}
+	}
+
+	return sysfs_emit(buf, "%u\n", value);
+}
+
+static ssize_t mini_led_mode_current_value_store(struct kobject *kobj,
+						struct kobj_attribute *attr,
+						const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	int result, err;
+	u32 mode;
+
+	err = kstrtou32(buf, 10, &mode);
+	if (err)
+		return err;
+
+	if (priv->mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE &&
+	    mode > ASUS_MINI_LED_ON)
+		return -EINVAL;
+	if (priv->mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2 &&
+	    mode > ASUS_MINI_LED_STRONG_MODE)
+		return -EINVAL;
+
+	/*
+	 * Remap the mode values so expected behaviour is the same as the last
+	 * generation of mini-LED with 0 == off, 1 == on.
+	 */
+	if (priv->mini_led_dev_id == ASUS_WMI_DEVID_MINI_LED_MODE2) {
+		switch (mode) {
+		case ASUS_MINI_LED_OFF:
+			mode = ASUS_MINI_LED_2024_OFF;
+			break;
+		case ASUS_MINI_LED_ON:
+			mode = ASUS_MINI_LED_2024_WEAK;
+			break;
+		case ASUS_MINI_LED_STRONG_MODE:
+			mode = ASUS_MINI_LED_2024_STRONG;
+			break;
+		}
+	}
+
+	err = armoury_set_devstate(priv, priv->mini_led_dev_id, mode, &result);
+	if (err == -EALREADY)
+		return count;
+	if (err) {
+		pr_warn("Failed to set mini-LED: %d\n", err);
+		return err;
+	}
+
+	if (result != 1) {
+		pr_warn("Failed to set mini-LED mode (result): 0x%x\n", result);
+		return -EIO;
+	}
+
+	armoury_attr_notify(kobj, attr);
+
+	return count;
+}
+
+static ssize_t mini_led_mode_possible_values_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+
+	switch (priv->mini_led_dev_id) {
+	case ASUS_WMI_DEVID_MINI_LED_MODE:
+		return sysfs_emit(buf, "0;1\n");
+	case ASUS_WMI_DEVID_MINI_LED_MODE2:
+		return sysfs_emit(buf, "0;1;2\n");
+	}
+
+	return sysfs_emit(buf, "0\n");
 }
 
-static ssize_t cores_efficiency_max_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
-{
-	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_MAX);
+ATTR_GROUP_ENUM_CUSTOM(mini_led_mode, "mini_led_mode", "Set the mini-LED backlight mode");
+
+/* The MUX can only go to dGPU mode with the dGPU enabled and the eGPU off */
+static int armoury_gpu_mux_check(struct asus_armoury_priv *priv, u32 optimus)
+{
+	int result, err;
+
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_DGPU)) {
+		err = armoury_get_devstate_uncached(priv, ASUS_WMI_DEVID_DGPU, &result);
+		if (err)
+			return err;
+		if (result && !optimus) {
+			err = -ENODEV;
+			pr_warn("Can not switch MUX to dGPU mode when dGPU is disabled: %02X %02X %d\n", result, optimus, err);
+			return err;
+		}
+	}
+
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_EGPU)) {
+		err = armoury_get_devstate_uncached(priv, ASUS_WMI_DEVID_EGPU, &result);
+		if (err)
+			return err;
+		if (result && !optimus) {
+			err = -ENODEV;
+			pr_warn("Can not switch MUX to dGPU mode when eGPU is enabled: %d\n", err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static ssize_t gpu_mux_mode_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	bool written = false;
+	int result, err;
+	u32 optimus;
+
+	err = kstrtou32(buf, 10, &optimus);
+	if (err)
+		return err;
+
+	if (optimus > 1)
+		return -EINVAL;
+
+	/* A staged change is checked again under priv->mutex when committed */
+	if (priv->staging) {
+		err = armoury_gpu_mux_check(priv, optimus);
+		if (err)
+			return err;
+	}
+
+	err = armoury_stage_store(priv, priv->gpu_mux_dev_id, optimus, ~0);
+	if (err)
+		return err < 0 ? err : count;
+
+	/* The dGPU and eGPU must not change between the checks and the write */
+	mutex_lock(&priv->mutex);
+
+	/* Skip the interlock checks too if the MUX is already there */
+	if (armoury_shadow_matches(priv, priv->gpu_mux_dev_id, optimus))
+		goto out_unlock;
+
+	err = armoury_gpu_mux_check(priv, optimus);
+	if (err)
+		goto out_unlock;
+
+	err = __armoury_set_devstate(priv, priv->gpu_mux_dev_id, optimus, &result);
+	if (err == -EALREADY) {
+		err = 0;
+		goto out_unlock;
+	}
+	if (err) {
+		pr_err("Failed to set GPU MUX mode: %d\n", err);
+		goto out_unlock;
+	}
+	/* !1 is considered a fail by ASUS */
+	if (result != 1) {
+		pr_warn("Failed to set GPU MUX mode (result): 0x%x\n", result);
+		err = -EIO;
+		goto out_unlock;
+	}
+	written = true;
+
+out_unlock:
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	if (written) {
+		armoury_attr_notify(kobj, attr);
+		asus_set_reboot_and_signal_event(priv);
+	}
+
+	return count;
+}
+WMI_SHOW_INT(gpu_mux_mode_current_value, "%d\n", priv->gpu_mux_dev_id);
+ATTR_GROUP_BOOL_CUSTOM(gpu_mux_mode, "gpu_mux_mode", "Set the GPU display MUX mode");
+
+/* Writes the dGPU state, never elided by the write shadow as explained below */
+static int armoury_dgpu_set(struct asus_armoury_priv *priv, u32 disable, u32 *result)
+{
+	lockdep_assert_held(&priv->mutex);
+
+	armoury_shadow_update(priv, ASUS_WMI_DEVID_DGPU, disable, false);
+	return __armoury_set_devstate(priv, ASUS_WMI_DEVID_DGPU, disable, result);
+}
+
+/*
+ * A user may be required to store the value twice, typical store first, then
+ * rescan PCI bus to activate power, then store a second time to save correctly.
+ * The reason for this is that an extra code path in the ACPI is enabled when
+ * the device and bus are powered. For this reason the store is never elided.
+ * gpu_mode does all of this in one store, see armoury_gpu_set_dgpu().
+ */
+static ssize_t dgpu_disable_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	int result, err;
+	u32 disable;
+
+	err = kstrtou32(buf, 10, &disable);
+	if (err)
+		return err;
+
+	if (disable > 1)
+		return -EINVAL;
+
+	/* The MUX must not change between the check and the write */
+	mutex_lock(&priv->mutex);
+
+	if (priv->gpu_mux_dev_id) {
+		err = armoury_get_devstate_uncached(priv, priv->gpu_mux_dev_id, &result);
+		if (err)
+			goto out_unlock;
+		if (!result && disable) {
+			err = -ENODEV;
+			pr_warn("Can not disable dGPU when the MUX is in dGPU mode: %d\n", err);
+			goto out_unlock;
+		}
+	}
+
+	err = armoury_dgpu_set(priv, disable, &result);
+	if (err) {
+		pr_warn("Failed to set dGPU disable: %d\n", err);
+		goto out_unlock;
+	}
+
+	if (result != 1) {
+		pr_warn("Failed to set dGPU disable (result): 0x%x\n", result);
+		err = -EIO;
+	}
+
+out_unlock:
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	armoury_attr_notify(kobj, attr);
+
+	return count;
+}
+WMI_SHOW_INT(dgpu_disable_current_value, "%d\n", ASUS_WMI_DEVID_DGPU);
+ATTR_GROUP_BOOL_CUSTOM(dgpu_disable, "dgpu_disable", "Disable the dGPU");
+
+/* The ACPI call to enable the eGPU also disables the internal dGPU */
+static ssize_t egpu_enable_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	bool written = false;
+	int result, err;
+	u32 enable;
+
+	err = kstrtou32(buf, 10, &enable);
+	if (err)
+		return err;
+
+	if (enable > 1)
+		return -EINVAL;
+
+	/* The MUX must not change between the check and the write */
+	mutex_lock(&priv->mutex);
+
+	err = armoury_get_devstate_uncached(priv, ASUS_WMI_DEVID_EGPU_CONNECTED, &result);
+	if (err) {
+		pr_warn("Failed to get eGPU connection status: %d\n", err);
+		goto out_unlock;
+	}
+
+	if (priv->gpu_mux_dev_id) {
+		err = armoury_get_devstate_uncached(priv, priv->gpu_mux_dev_id, &result);
+		if (err) {
+			pr_warn("Failed to get GPU MUX status: %d\n", err);
+			goto out_unlock;
+		}
+		if (!result && enable) {
+			err = -ENODEV;
+			pr_warn("Can not enable eGPU when the MUX is in dGPU mode: %d\n", err);
+			goto out_unlock;
+		}
+	}
+
+	err = __armoury_set_devstate(priv, ASUS_WMI_DEVID_EGPU, enable, &result);
+	if (err == -EALREADY) {
+		err = 0;
+		goto out_unlock;
+	}
+	/* Enabling the eGPU also changes the dGPU state */
+	armoury_devstate_invalidate_all(priv);
+	if (err) {
+		pr_warn("Failed to set eGPU state: %d\n", err);
+		goto out_unlock;
+	}
+
+	if (result != 1) {
+		pr_warn("Failed to set eGPU state (retval): 0x%x\n", result);
+		err = -EIO;
+		goto out_unlock;
+	}
+	written = true;
+
+out_unlock:
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	if (written)
+		armoury_attr_notify(kobj, attr);
+
+	return count;
+}
+WMI_SHOW_INT(egpu_enable_current_value, "%d\n", ASUS_WMI_DEVID_EGPU);
+ATTR_GROUP_BOOL_CUSTOM(egpu_enable, "egpu_enable", "Enable the eGPU (also disables dGPU)");
+
+/*
+ * gpu_mode sets the MUX, dGPU and eGPU in one store. The whole change runs
+ * under priv->mutex from state read fresh, and takes care of the PCI removal
+ * and rescan that dgpu_disable otherwise leaves to the user.
+ */
+enum armoury_gpu_mode {
+	ARMOURY_GPU_INTEGRATED,
+	ARMOURY_GPU_HYBRID,
+	ARMOURY_GPU_DGPU,
+	ARMOURY_GPU_EGPU,
+};
+
+struct armoury_gpu_state {
+	u32 mux;
+	u32 dgpu;
+	u32 egpu;
+};
+
+/* The modes @priv supports, hybrid is what machines without any switch run */
+static unsigned long armoury_gpu_modes(struct asus_armoury_priv *priv)
+{
+	unsigned long modes = BIT(ARMOURY_GPU_HYBRID);
+
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_DGPU))
+		modes |= BIT(ARMOURY_GPU_INTEGRATED);
+	if (priv->gpu_mux_dev_id)
+		modes |= BIT(ARMOURY_GPU_DGPU);
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_EGPU))
+		modes |= BIT(ARMOURY_GPU_EGPU);
+
+	return modes;
+}
+
+static bool armoury_gpu_mode_visible(struct asus_armoury_priv *priv)
+{
+	return armoury_gpu_modes(priv) != BIT(ARMOURY_GPU_HYBRID);
+}
+
+/*
+ * Reads @dev_id without the presence bit, or gives @def if it is missing.
+ * @fresh skips the cache and the budget, for reads under priv->mutex.
+ */
+static int armoury_gpu_get(struct asus_armoury_priv *priv, u32 dev_id, u32 def,
+			   bool fresh, u32 *value)
+{
+	int err;
+
+	if (!dev_id || !asus_wmi_is_present(priv, dev_id)) {
+		*value = def;
+		return 0;
+	}
+
+	if (fresh)
+		err = armoury_get_devstate_uncached(priv, dev_id, value);
+	else
+		err = armoury_get_devstate(priv, dev_id, value);
+	*value &= ~ASUS_WMI_DSTS_PRESENCE_BIT;
+
+	return err;
+}
+
+static int armoury_gpu_read(struct asus_armoury_priv *priv,
+			    struct armoury_gpu_state *st, bool fresh)
+{
+	int err;
+
+	err = armoury_gpu_get(priv, priv->gpu_mux_dev_id, 1, fresh, &st->mux);
+	if (!err)
+		err = armoury_gpu_get(priv, ASUS_WMI_DEVID_DGPU, 0, fresh, &st->dgpu);
+	if (!err)
+		err = armoury_gpu_get(priv, ASUS_WMI_DEVID_EGPU, 0, fresh, &st->egpu);
+
+	return err;
+}
+
+static enum armoury_gpu_mode armoury_gpu_state_mode(const struct armoury_gpu_state *st)
+{
+	if (st->egpu)
+		return ARMOURY_GPU_EGPU;
+	if (!st->mux)
+		return ARMOURY_GPU_DGPU;
+	if (st->dgpu)
+		return ARMOURY_GPU_INTEGRATED;
+
+	return ARMOURY_GPU_HYBRID;
+}
+
+/*
+ * The internal dGPU is a display device on another bus than the one the
+ * machine booted on. Devices behind an external facing port, as an eGPU or a
+ * dock would be, are never taken for it.
+ */
+static bool armoury_gpu_is_dgpu(struct pci_dev *pdev, struct pci_dev *boot)
+{
+	if (pdev == boot || pdev->bus == boot->bus)
+		return false;
+
+	return !pdev->untrusted && !pci_is_thunderbolt_attached(pdev);
+}
+
+static struct pci_dev *armoury_gpu_find_dgpu(struct pci_dev *boot)
+{
+	struct pci_dev *pdev = NULL;
+
+	while ((pdev = pci_get_base_class(PCI_BASE_CLASS_DISPLAY, pdev))) {
+		if (armoury_gpu_is_dgpu(pdev, boot))
+			return pdev;
+	}
+
+	return NULL;
+}
+
+/* The mock and replay backends do not switch any GPU on the bus */
+static bool armoury_gpu_on_bus(struct asus_armoury_priv *priv)
+{
+	return priv->wmi_ops == &armoury_asus_wmi_ops;
+}
+
+/*
+ * Removes the functions of the dGPU from the bus before its power goes, its
+ * audio and USB-C controllers share the slot. Without a boot device the
+ * integrated GPU can not be told apart, and the dGPU must not lose power while
+ * still on the bus, so the switch is refused.
+ */
+static int armoury_gpu_remove(struct asus_armoury_priv *priv)
+{
+	struct pci_dev *boot = vga_default_device();
+	struct pci_dev *pdev, *fn;
+	struct pci_bus *bus;
+	unsigned int slot;
+
+	if (!armoury_gpu_on_bus(priv))
+		return 0;
+
+	if (!boot) {
+		pr_warn("No boot display device, can not remove the dGPU\n");
+		return -ENODEV;
+	}
+
+	pci_lock_rescan_remove();
+	pdev = armoury_gpu_find_dgpu(boot);
+	if (pdev) {
+		bus = pdev->bus;
+		slot = PCI_SLOT(pdev->devfn);
+		for (int i = 7; i >= 0; i--) {
+			fn = pci_get_slot(bus, PCI_DEVFN(slot, i));
+			if (!fn)
+				continue;
+			pci_stop_and_remove_bus_device(fn);
+			pci_dev_put(fn);
+		}
+		pci_dev_put(pdev);
+	}
+	pci_unlock_rescan_remove();
+
+	return 0;
+}
+
+/* As a write to /sys/bus/pci/rescan */
+static void armoury_gpu_rescan(struct asus_armoury_priv *priv)
+{
+	struct pci_bus *bus = NULL;
+
+	if (!armoury_gpu_on_bus(priv))
+		return;
+
+	pci_lock_rescan_remove();
+	while ((bus = pci_find_next_bus(bus)))
+		pci_rescan_bus(bus);
+	pci_unlock_rescan_remove();
+}
+
+static int armoury_gpu_set(struct asus_armoury_priv *priv, u32 dev_id, u32 value)
+{
+	u32 result;
+	int err;
+
+	err = __armoury_set_devstate(priv, dev_id, value, &result);
+	if (err == -EALREADY)
+		return 0;
+	if (!err && result != 1)
+		return -EIO;
+
+	return err;
+}
+
+/*
+ * As in dgpu_disable_current_value_store(), enabling is stored a second time
+ * once a rescan has brought the powered dGPU back onto the bus.
+ */
+static int armoury_gpu_set_dgpu(struct asus_armoury_priv *priv, u32 disable)
+{
+	u32 result;
+	int err;
+
+	if (disable) {
+		err = armoury_gpu_remove(priv);
+		if (err)
+			return err;
+	}
+
+	err = armoury_dgpu_set(priv, disable, &result);
+	if (!err && result != 1)
+		err = -EIO;
+	if (!err && !disable) {
+		armoury_gpu_rescan(priv);
+		err = armoury_dgpu_set(priv, disable, &result);
+		if (!err && result != 1)
+			err = -EIO;
+	}
+
+	return err;
+}
+
+static int armoury_gpu_set_egpu(struct asus_armoury_priv *priv, u32 enable)
+{
+	int err;
+
+	if (enable) {
+		err = armoury_gpu_remove(priv);
+		if (err)
+			return err;
+	}
+
+	err = armoury_gpu_set(priv, ASUS_WMI_DEVID_EGPU, enable);
+	/* Switching the eGPU also changes the dGPU state */
+	armoury_devstate_invalidate_all(priv);
+	if (!err && enable)
+		armoury_gpu_rescan(priv);
+
+	return err;
+}
+
+/*
+ * Runs the steps from the current state to @mode. As with the single
+ * attributes, the dGPU can not be disabled nor the eGPU enabled while the MUX
+ * is in dGPU mode. Sets @reboot if the MUX was switched.
+ */
+static int armoury_gpu_switch(struct asus_armoury_priv *priv,
+			      enum armoury_gpu_mode mode, bool *reboot)
+{
+	struct armoury_gpu_state st;
+	u32 connected;
+	int err;
+
+	lockdep_assert_held(&priv->mutex);
+
+	err = armoury_gpu_read(priv, &st, true);
+	if (err)
+		return err;
+
+	if (!st.mux && (mode == ARMOURY_GPU_INTEGRATED || mode == ARMOURY_GPU_EGPU))
+		return -ENODEV;
+
+	if (mode == ARMOURY_GPU_EGPU) {
+		err = armoury_gpu_get(priv, ASUS_WMI_DEVID_EGPU_CONNECTED, 0, true,
+				      &connected);
+		if (err)
+			return err;
+		if (!connected)
+			return -ENODEV;
+	}
+
+	if (st.egpu && mode != ARMOURY_GPU_EGPU) {
+		err = armoury_gpu_set_egpu(priv, 0);
+		if (!err)
+			err = armoury_gpu_read(priv, &st, true);
+		if (err)
+			return err;
+	}
+
+	switch (mode) {
+	case ARMOURY_GPU_INTEGRATED:
+		if (!st.dgpu)
+			err = armoury_gpu_set_dgpu(priv, 1);
+		break;
+	case ARMOURY_GPU_HYBRID:
+	case ARMOURY_GPU_DGPU:
+		if (st.dgpu)
+			err = armoury_gpu_set_dgpu(priv, 0);
+		/* The MUX is set here and now, not by a change staged before */
+		__clear_bit(ARMOURY_STAGE_GPU_MUX, &priv->staged);
+		if (!err && st.mux != (mode == ARMOURY_GPU_HYBRID)) {
+			err = armoury_gpu_set(priv, priv->gpu_mux_dev_id,
+					      mode == ARMOURY_GPU_HYBRID);
+			*reboot = !err;
+		}
+		break;
+	case ARMOURY_GPU_EGPU:
+		if (!st.egpu)
+			err = armoury_gpu_set_egpu(priv, 1);
+		break;
+	}
+
+	return err;
+}
+
+static ssize_t gpu_mode_current_value_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_gpu_state st;
+	int err;
+
+	err = armoury_gpu_read(priv, &st, false);
+	if (err)
+		return err;
+
+	return sysfs_emit(buf, "%d\n", armoury_gpu_state_mode(&st));
+}
+
+static ssize_t gpu_mode_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_gpu_state old, new;
+	bool reboot = false;
+	u32 mode;
+	int err;
+
+	err = kstrtou32(buf, 10, &mode);
+	if (err)
+		return err;
+
+	if (mode > ARMOURY_GPU_EGPU || !(armoury_gpu_modes(priv) & BIT(mode)))
+		return -EINVAL;
+
+	mutex_lock(&priv->mutex);
+	err = armoury_gpu_read(priv, &old, true);
+	if (!err)
+		err = armoury_gpu_switch(priv, mode, &reboot);
+	/* Also on failure, to notify for the steps that were taken */
+	if (armoury_gpu_read(priv, &new, true))
+		new = old;
+	mutex_unlock(&priv->mutex);
+
+	if (new.mux != old.mux)
+		armoury_attr_notify(kobj, &attr_gpu_mux_mode_current_value);
+	if (new.dgpu != old.dgpu)
+		armoury_attr_notify(kobj, &attr_dgpu_disable_current_value);
+	if (new.egpu != old.egpu)
+		armoury_attr_notify(kobj, &attr_egpu_enable_current_value);
+	if (armoury_gpu_state_mode(&new) != armoury_gpu_state_mode(&old))
+		armoury_attr_notify(kobj, attr);
+
+	if (err) {
+		pr_warn("Failed to switch GPU mode: %d\n", err);
+		return err;
+	}
+
+	if (reboot)
+		asus_set_reboot_and_signal_event(priv);
+
+	return count;
+}
+
+static ssize_t gpu_mode_possible_values_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	unsigned long modes = armoury_gpu_modes(armoury_priv(kobj));
+	ssize_t len = 0;
+	int mode;
+
+	for_each_set_bit(mode, &modes, ARMOURY_GPU_EGPU + 1)
+		len += sysfs_emit_at(buf, len, "%s%d", len ? ";" : "", mode);
+
+	return len + sysfs_emit_at(buf, len, "\n");
+}
+
+ATTR_GROUP_ENUM_CUSTOM(gpu_mode, "gpu_mode",
+		"Set the GPU mode: integrated<0>, hybrid<1>, dGPU<2> or eGPU<3>");
+
+/* Device memory available to APU */
+
+/*
+ * The possible_values index of the raw firmware setting @mem. Firmware may
+ * report index 0 as 256, but a store of index 0 writes 0.
+ */
+static u32 armoury_apu_mem_index(u32 mem)
+{
+	switch (mem) {
+	case 0:
+	case 256:
+		return 0;
+	case 258:
+		return 1;
+	case 259:
+		return 2;
+	case 260:
+		return 3;
+	case 261:
+		return 4;
+	case 262:
+		/* This is out of order and looks wrong but is correct */
+		return 8;
+	case 263:
+		return 5;
+	case 264:
+		return 6;
+	case 265:
+		return 7;
+	}
+
+	return 4;
+}
+
+static ssize_t apu_mem_current_value_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	int err;
+	u32 mem;
+
+	err = armoury_get_devstate(priv, ASUS_WMI_DEVID_APU_MEM, &mem);
+	if (err)
+		return err;
+
+	return sysfs_emit(buf, "%u\n", armoury_apu_mem_index(mem));
+}
+
+static ssize_t apu_mem_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	int result, err;
+	u32 requested, mem;
+
+	result = kstrtou32(buf, 10, &requested);
+	if (result)
+		return result;
+
+	switch (requested) {
+	case 0:
+		mem = 0;
+		break;
+	case 1:
+		mem = 258;
+		break;
+	case 2:
+		mem = 259;
+		break;
+	case 3:
+		mem = 260;
+		break;
+	case 4:
+		mem = 261;
+		break;
+	case 5:
+		mem = 263;
+		break;
+	case 6:
+		mem = 264;
+		break;
+	case 7:
+		mem = 265;
+		break;
+	case 8:
+		/* This is out of order and looks wrong but is correct */
+		mem = 262;
+		break;
+	default:
+		return -EIO;
+	}
+
+	err = armoury_stage_store(priv, ASUS_WMI_DEVID_APU_MEM, mem, ~0);
+	if (err)
+		return err < 0 ? err : count;
+
+	err = armoury_set_devstate(priv, ASUS_WMI_DEVID_APU_MEM, mem, &result);
+	if (err == -EALREADY)
+		return count;
+	if (err) {
+		pr_warn("Failed to set apu_mem: %d\n", err);
+		return err;
+	}
+
+	pr_info("APU memory changed to %uGB, reboot required\n", requested);
+	armoury_attr_notify(kobj, attr);
+
+	asus_set_reboot_and_signal_event(priv);
+
+	return count;
+}
+
+static ssize_t apu_mem_possible_values_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "0;1;2;3;4;5;6;7;8\n");
+}
+ATTR_GROUP_ENUM_CUSTOM(apu_mem, "apu_mem", "Set the available system memory for the APU to use");
+
+static int init_max_cpu_cores(struct asus_armoury_priv *priv,
+			      struct rog_tunables *rog)
+{
+	u32 cores;
+	int err;
+
+	rog->min_perf_cores = 4;
+	rog->max_perf_cores = 4;
+	rog->cur_perf_cores = 4;
+	rog->min_power_cores = 0;
+	rog->max_power_cores = 8;
+	rog->cur_power_cores = 8;
+
+	err = armoury_get_devstate(priv, ASUS_WMI_DEVID_CORES_MAX, &cores);
+	if (err)
+		return err;
+
+	cores &= ~ASUS_WMI_DSTS_PRESENCE_BIT;
+	rog->max_power_cores = FIELD_GET(ASUS_POWER_CORE_MASK, cores);
+	rog->max_perf_cores = FIELD_GET(ASUS_PERF_CORE_MASK, cores);
+
+	cores = 0;
+	err = armoury_get_devstate(priv, ASUS_WMI_DEVID_CORES, &cores);
+	if (err)
+		return err;
+
+	rog->cur_perf_cores = FIELD_GET(ASUS_PERF_CORE_MASK, cores);
+	rog->cur_power_cores = FIELD_GET(ASUS_POWER_CORE_MASK, cores);
+
+	return 0;
+}
+
+/*
+ * Publishes the core counts of @cores, a raw CORES value firmware took, in
+ * one copy of the tunables. Called with priv->mutex held.
+ */
+static void armoury_cores_publish(struct asus_armoury_priv *priv, u32 cores)
+{
+	struct rog_tunables *old = armoury_tunables_locked(priv);
+	struct rog_tunables *new;
+
+	new = kmemdup(old, sizeof(*old), GFP_KERNEL | __GFP_NOFAIL);
+	new->cur_perf_cores = FIELD_GET(ASUS_PERF_CORE_MASK, cores);
+	new->cur_power_cores = FIELD_GET(ASUS_POWER_CORE_MASK, cores);
+	rcu_assign_pointer(priv->rog_tunables, new);
+	kfree_rcu(old, rcu);
+}
+
+static ssize_t cores_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf,
+					enum cpu_core_type core_type,
+					enum cpu_core_value core_value)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	u32 cores;
+
+	switch (core_value) {
+	case CPU_CORE_DEFAULT:
+	case CPU_CORE_MAX:
+		if (core_type == CPU_CORE_PERF)
+			return sysfs_emit(buf, "%d\n", armoury_tunables_read(priv, max_perf_cores));
+		else
+			return sysfs_emit(buf, "%d\n", armoury_tunables_read(priv, max_power_cores));
+	case CPU_CORE_MIN:
+		if (core_type == CPU_CORE_PERF)
+			return sysfs_emit(buf, "%d\n", armoury_tunables_read(priv, min_perf_cores));
+		else
+			return sysfs_emit(buf, "%d\n", armoury_tunables_read(priv, min_power_cores));
+	default:
+		break;
+	}
+
+	if (core_type == CPU_CORE_PERF)
+		cores = armoury_tunables_read(priv, cur_perf_cores);
+	else
+		cores = armoury_tunables_read(priv, cur_power_cores);
+
+	return sysfs_emit(buf, "%d\n", cores);
+}
+
+static ssize_t cores_current_value_store(struct kobject *kobj,
+				struct kobj_attribute *attr, const char *buf,
+				enum cpu_core_type core_type)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct rog_tunables *rog;
+	int result, err;
+	u32 new_cores, perf_cores, powr_cores, out_val, min, max;
+
+	result = kstrtou32(buf, 10, &new_cores);
+	if (result)
+		return result;
+
+	rcu_read_lock();
+	rog = rcu_dereference(priv->rog_tunables);
+	if (core_type == CPU_CORE_PERF) {
+		min = rog->min_perf_cores;
+		max = rog->max_perf_cores;
+	} else {
+		min = rog->min_power_cores;
+		max = rog->max_power_cores;
+	}
+	rcu_read_unlock();
+
+	if (new_cores < min || new_cores > max)
+		return -EINVAL;
+
+	/* A staged change keeps the other core type as staged before */
+	if (core_type == CPU_CORE_PERF)
+		err = armoury_stage_store(priv, ASUS_WMI_DEVID_CORES,
+					  FIELD_PREP(ASUS_PERF_CORE_MASK, new_cores),
+					  ASUS_PERF_CORE_MASK);
+	else
+		err = armoury_stage_store(priv, ASUS_WMI_DEVID_CORES,
+					  FIELD_PREP(ASUS_POWER_CORE_MASK, new_cores),
+					  ASUS_POWER_CORE_MASK);
+	if (err)
+		return err < 0 ? err : 0;
+
+	/* The other core count must not change between reading and writing it */
+	mutex_lock(&priv->mutex);
+	rog = armoury_tunables_locked(priv);
+	if (core_type == CPU_CORE_PERF) {
+		perf_cores = new_cores;
+		powr_cores = rog->cur_power_cores;
+	} else {
+		perf_cores = rog->cur_perf_cores;
+		powr_cores = new_cores;
+	}
+
+	out_val = 0;
+	out_val |= FIELD_PREP(ASUS_PERF_CORE_MASK, perf_cores);
+	out_val |= FIELD_PREP(ASUS_POWER_CORE_MASK, powr_cores);
+
+	err = __armoury_set_devstate(priv, ASUS_WMI_DEVID_CORES, out_val, &result);
+	if (err == -EALREADY || (!err && result <= 1))
+		armoury_cores_publish(priv, out_val);
+	mutex_unlock(&priv->mutex);
+	if (err == -EALREADY)
+		return 0;
+	if (err) {
+		pr_warn("Failed to set CPU core count: %d\n", err);
+		return err;
+	}
+
+	if (result > 1) {
+		pr_warn("Failed to set CPU core count (result): 0x%x\n", result);
+		return -EIO;
+	}
+
+	pr_info("CPU core count changed, reboot required\n");
+	armoury_attr_notify(kobj, attr);
+	asus_set_reboot_and_signal_event(priv);
+
+	return 0;
+}
+
+static ssize_t cores_performance_min_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_MIN);
+}
+
+static ssize_t cores_performance_max_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_MAX);
+}
+
+static ssize_t cores_performance_default_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_DEFAULT);
+}
+
+static ssize_t cores_performance_current_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_PERF, CPU_CORE_CURRENT);
+}
+
+static ssize_t cores_performance_current_value_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+
+	err = cores_current_value_store(kobj, attr, buf, CPU_CORE_PERF);
+	if (err)
+		return err;
+
+	return count;
+}
+ATTR_GROUP_CORES_RW(cores_performance, "cores_performance",
+		"Set the max available performance cores");
+
+static ssize_t cores_efficiency_min_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_MIN);
+}
+
+static ssize_t cores_efficiency_max_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_MAX);
+}
+
+static ssize_t cores_efficiency_default_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_DEFAULT);
+}
+
+static ssize_t cores_efficiency_current_value_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_CURRENT);
+}
+
+static ssize_t cores_efficiency_current_value_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+
+	err = cores_current_value_store(kobj, attr, buf, CPU_CORE_POWER);
+	if (err)
+		return err;
+
+	return count;
+}
+ATTR_GROUP_CORES_RW(cores_efficiency, "cores_efficiency",
+		"Set the max available efficiency cores");
+
+/* Simple attribute creation */
+ATTR_GROUP_ROG_TUNABLE(ppt_pl1_spl, "ppt_pl1_spl", ASUS_WMI_DEVID_PPT_PL1_SPL,
+		cpu_default, cpu_min, cpu_max, 1, "Set the CPU slow package limit");
+ATTR_GROUP_ROG_TUNABLE(ppt_pl2_sppt, "ppt_pl2_sppt", ASUS_WMI_DEVID_PPT_PL2_SPPT,
+		cpu_default, cpu_min, cpu_max, 1, "Set the CPU fast package limit");
+ATTR_GROUP_ROG_TUNABLE(ppt_apu_sppt, "ppt_apu_sppt", ASUS_WMI_DEVID_PPT_APU_SPPT,
+		platform_default, platform_min, platform_max, 1, "Set the CPU slow package limit");
+ATTR_GROUP_ROG_TUNABLE(ppt_platform_sppt, "ppt_platform_sppt", ASUS_WMI_DEVID_PPT_PLAT_SPPT,
+		platform_default, platform_min, platform_max, 1, "Set the CPU slow package limit");
+ATTR_GROUP_ROG_TUNABLE(ppt_fppt, "ppt_fppt", ASUS_WMI_DEVID_PPT_FPPT,
+		cpu_default, cpu_min, cpu_max, 1, "Set the CPU slow package limit");
+
+ATTR_GROUP_ROG_TUNABLE(nv_dynamic_boost, "nv_dynamic_boost", ASUS_WMI_DEVID_NV_DYN_BOOST,
+		nv_boost_default, nv_boost_min, nv_boost_max, 1, "Set the Nvidia dynamic boost limit");
+ATTR_GROUP_ROG_TUNABLE(nv_temp_target, "nv_temp_target", ASUS_WMI_DEVID_NV_THERM_TARGET,
+		nv_temp_default, nv_boost_min, nv_temp_max, 1, "Set the Nvidia max thermal limit");
+ATTR_GROUP_INT_VALUE_ONLY_RO(dgpu_base_tgp, "dgpu_base_tgp", ASUS_WMI_DEVID_DGPU_BASE_TGP,
+		"Read the base TGP value");
+ATTR_GROUP_ROG_TUNABLE(dgpu_tgp, "dgpu_tgp", ASUS_WMI_DEVID_DGPU_SET_TGP,
+		dgpu_tgp_default, dgpu_tgp_min, dgpu_tgp_max, 1,
+		"Set the additional TGP on top of the base TGP");
+
+ATTR_GROUP_ENUM_INT_RO(charge_mode, "charge_mode", ASUS_WMI_DEVID_CHARGE_MODE,
+		"0;1;2", "Show the current mode of charging");
+ATTR_GROUP_BOOL_RW(boot_sound, "boot_sound", ASUS_WMI_DEVID_BOOT_SOUND,
+		"Set the boot POST sound");
+ATTR_GROUP_BOOL_RW(mcu_powersave, "mcu_powersave", ASUS_WMI_DEVID_MCU_POWERSAVE,
+		"Set MCU powersaving mode");
+ATTR_GROUP_BOOL_RW(panel_od, "panel_overdrive", ASUS_WMI_DEVID_PANEL_OD,
+		"Set the panel refresh overdrive");
+ATTR_GROUP_BOOL_RW(panel_hd_mode, "panel_hd_mode", ASUS_WMI_DEVID_PANEL_HD,
+		"Set the panel HD mode to UHD<0> or FHD<1>");
+ATTR_GROUP_BOOL_RO(egpu_connected, "egpu_connected", ASUS_WMI_DEVID_EGPU_CONNECTED,
+		"Show the eGPU connection status");
+
+/* If an attribute does not require any special case handling add it here */
+static const struct asus_attr_group armoury_attr_groups[] = {
+	{ &egpu_connected_attr_group, ASUS_WMI_DEVID_EGPU_CONNECTED },
+	{ &egpu_enable_attr_group, ASUS_WMI_DEVID_EGPU },
+	{ &dgpu_disable_attr_group, ASUS_WMI_DEVID_DGPU },
+
+	{ &ppt_pl1_spl_attr_group, ASUS_WMI_DEVID_PPT_PL1_SPL },
+	{ &ppt_pl2_sppt_attr_group, ASUS_WMI_DEVID_PPT_PL2_SPPT },
+	{ &ppt_apu_sppt_attr_group, ASUS_WMI_DEVID_PPT_APU_SPPT },
+	{ &ppt_platform_sppt_attr_group, ASUS_WMI_DEVID_PPT_PLAT_SPPT },
+	{ &ppt_fppt_attr_group, ASUS_WMI_DEVID_PPT_FPPT },
+	{ &nv_dynamic_boost_attr_group, ASUS_WMI_DEVID_NV_DYN_BOOST },
+	{ &nv_temp_target_attr_group, ASUS_WMI_DEVID_NV_THERM_TARGET },
+	{ &dgpu_base_tgp_attr_group, ASUS_WMI_DEVID_DGPU_BASE_TGP },
+	{ &dgpu_tgp_attr_group, ASUS_WMI_DEVID_DGPU_SET_TGP },
+	{ &apu_mem_attr_group, ASUS_WMI_DEVID_APU_MEM },
+	{ &cores_efficiency_attr_group, ASUS_WMI_DEVID_CORES_MAX },
+	{ &cores_performance_attr_group, ASUS_WMI_DEVID_CORES_MAX },
+
+	{ &charge_mode_attr_group, ASUS_WMI_DEVID_CHARGE_MODE },
+	{ &boot_sound_attr_group, ASUS_WMI_DEVID_BOOT_SOUND },
+	{ &mcu_powersave_attr_group, ASUS_WMI_DEVID_MCU_POWERSAVE },
+	{ &panel_od_attr_group, ASUS_WMI_DEVID_PANEL_OD },
+	{ &panel_hd_mode_attr_group, ASUS_WMI_DEVID_PANEL_HD },
+};
+
+static bool armoury_group_has_attr(const struct attribute_group *group,
+				   struct kobj_attribute *attr)
+{
+	for (struct attribute **a = group->attrs; *a; a++) {
+		if (*a == &attr->attr)
+			return true;
+	}
+
+	return false;
+}
+
+/* The groups are not kobjects of their own, so look the name up */
+static const char *armoury_attr_group_name(struct kobj_attribute *attr)
+{
+	if (armoury_group_has_attr(&mini_led_mode_attr_group, attr))
+		return mini_led_mode_attr_group.name;
+	if (armoury_group_has_attr(&gpu_mux_mode_attr_group, attr))
+		return gpu_mux_mode_attr_group.name;
+	if (armoury_group_has_attr(&gpu_mode_attr_group, attr))
+		return gpu_mode_attr_group.name;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (armoury_group_has_attr(armoury_attr_groups[i].attr_group, attr))
+			return armoury_attr_groups[i].attr_group->name;
+	}
+
+	return NULL;
+}
+
+/* Whether asus_fw_attr_add() creates armoury_attr_groups[@i] for @priv */
+static bool armoury_attr_group_visible(struct asus_armoury_priv *priv, int i)
+{
+	u32 dev_id = armoury_attr_groups[i].wmi_devid;
+
+	/* Do not show for the Ally devices as powersave is entirely unreliable on it */
+	if (dev_id == ASUS_WMI_DEVID_MCU_POWERSAVE &&
+	    dmi_check_system(asus_rog_ally_device))
+		return false;
+
+	return asus_wmi_is_present(priv, dev_id);
+}
+
+/* Snapshot *******************************************************************/
+
+static const char * const armoury_snapshot_attrs[] = {
+	"current_value",
+	"min_value",
+	"max_value",
+	"default_value",
+};
+
+static ssize_t armoury_snapshot_group(struct kobject *kobj,
+				      const struct attribute_group *group,
+				      char *buf, ssize_t len, char *tmp)
+{
+	struct kobj_attribute *kattr;
+	ssize_t ret;
+
+	for (struct attribute **a = group->attrs; *a; a++) {
+		if (match_string(armoury_snapshot_attrs, ARRAY_SIZE(armoury_snapshot_attrs),
+				 (*a)->name) < 0)
+			continue;
+
+		kattr = container_of(*a, struct kobj_attribute, attr);
+		ret = kattr->show(kobj, kattr, tmp);
+		if (ret < 0) {
+			len += sysfs_emit_at(buf, len, "%s.%s!error=%zd\n", group->name,
+					     (*a)->name, ret);
+			continue;
+		}
+		tmp[min_t(ssize_t, ret, PAGE_SIZE - 1)] = '\0';
+
+		len += sysfs_emit_at(buf, len, "%s.%s=%s\n", group->name, (*a)->name,
+				     strim(tmp));
+	}
+
+	return len;
+}
+
+/*
+ * Every value, limit and default this instance shows, one "group.attr=value"
+ * per line after pending_reboot, or "group.attr!error=errno" for one that
+ * failed to read. Holding priv->mutex keeps out all writes, so the values are
+ * those of a single point in time. The snapshot is admitted against the
+ * budget once, before taking the mutex, and its reads never wait under it.
+ */
+static ssize_t snapshot_show(struct kobject *kobj, struct kobj_attribute *attr,
+			     char *buf)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	ssize_t len;
+	char *tmp;
+	int err;
+
+	err = armoury_fw_budget_take(true);
+	if (err)
+		return err;
+
+	tmp = (char *)get_zeroed_page(GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	mutex_lock(&priv->mutex);
+	WRITE_ONCE(priv->snapshot_task, current);
+	len = sysfs_emit(buf, "pending_reboot=%d\n", priv->pending_reboot);
+	if (priv->mini_led_dev_id)
+		len = armoury_snapshot_group(kobj, &mini_led_mode_attr_group, buf, len, tmp);
+	if (priv->gpu_mux_dev_id)
+		len = armoury_snapshot_group(kobj, &gpu_mux_mode_attr_group, buf, len, tmp);
+	if (armoury_gpu_mode_visible(priv))
+		len = armoury_snapshot_group(kobj, &gpu_mode_attr_group, buf, len, tmp);
+	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (armoury_attr_group_visible(priv, i))
+			len = armoury_snapshot_group(kobj, armoury_attr_groups[i].attr_group,
+						     buf, len, tmp);
+	}
+	WRITE_ONCE(priv->snapshot_task, NULL);
+	mutex_unlock(&priv->mutex);
+
+	free_page((unsigned long)tmp);
+	return len;
+}
+
+static struct kobj_attribute snapshot = __ATTR_RO(snapshot);
+
+/* Staged changes *************************************************************/
+
+static bool stage_reboot;
+module_param(stage_reboot, bool, 0444);
+MODULE_PARM_DESC(stage_reboot,
+		 "Stage values that need a reboot, writing them on reboot or to attributes/commit");
+
+static u32 armoury_stage_dev_id(struct asus_armoury_priv *priv, int idx)
+{
+	switch (idx) {
+	case ARMOURY_STAGE_APU_MEM:
+		return ASUS_WMI_DEVID_APU_MEM;
+	case ARMOURY_STAGE_CORES:
+		return ASUS_WMI_DEVID_CORES;
+	case ARMOURY_STAGE_PANEL_HD:
+		return ASUS_WMI_DEVID_PANEL_HD;
+	case ARMOURY_STAGE_GPU_MUX:
+		return priv->gpu_mux_dev_id;
+	}
+
+	return 0;
+}
+
+static const char * const armoury_stage_names[] = {
+	[ARMOURY_STAGE_APU_MEM] = "apu_mem",
+	[ARMOURY_STAGE_CORES] = "cores",
+	[ARMOURY_STAGE_PANEL_HD] = "panel_hd_mode",
+	[ARMOURY_STAGE_GPU_MUX] = "gpu_mux_mode",
+};
+
+static int armoury_stage_find(struct asus_armoury_priv *priv, u32 dev_id)
+{
+	for (int i = 0; i < ARMOURY_STAGE_COUNT; i++) {
+		if (dev_id && armoury_stage_dev_id(priv, i) == dev_id)
+			return i;
+	}
+
+	return -ENOENT;
+}
+
+/* The raw value firmware has for @idx, what takes effect without a commit */
+static int armoury_stage_firmware(struct asus_armoury_priv *priv, int idx,
+				  u32 *value)
+{
+	int err;
+
+	lockdep_assert_held(&priv->mutex);
+
+	/* Under priv->mutex, so past the budget as with the interlock reads */
+	err = __armoury_get_devstate(priv, armoury_stage_dev_id(priv, idx), value, false);
+	*value &= ~ASUS_WMI_DSTS_PRESENCE_BIT;
+
+	return err;
+}
+
+static u32 armoury_pending_perf_cores(u32 cores)
+{
+	return FIELD_GET(ASUS_PERF_CORE_MASK, cores);
+}
+
+static u32 armoury_pending_power_cores(u32 cores)
+{
+	return FIELD_GET(ASUS_POWER_CORE_MASK, cores);
+}
+
+/*
+ * The pending_value of an attribute that needs a reboot. Cores share one
+ * firmware value between two attributes, @decode picks the part to show.
+ */
+struct armoury_pending {
+	struct kobj_attribute attr;
+	struct kobj_attribute *current_value;
+	const struct attribute_group *group;
+	int stage;
+	u32 (*decode)(u32 value);
+};
+
+static ssize_t armoury_pending_show(struct kobject *kobj, struct kobj_attribute *attr,
+				    char *buf)
+{
+	struct armoury_pending *p = container_of(attr, struct armoury_pending, attr);
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	u32 value;
+	int err = 0;
+
+	mutex_lock(&priv->mutex);
+	if (test_bit(p->stage, &priv->staged))
+		value = priv->staged_value[p->stage];
+	else
+		err = armoury_stage_firmware(priv, p->stage, &value);
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	return sysfs_emit(buf, "%u\n", p->decode ? p->decode(value) : value);
+}
+
+#define ARMOURY_PENDING(_attrname, _stage, _decode) {				\
+	.attr = __ATTR(pending_value, 0444, armoury_pending_show, NULL),	\
+	.current_value = &attr_##_attrname##_current_value,			\
+	.group = &_attrname##_attr_group,					\
+	.stage = _stage,							\
+	.decode = _decode,							\
+}
+
+static struct armoury_pending armoury_pending_attrs[] = {
+	ARMOURY_PENDING(apu_mem, ARMOURY_STAGE_APU_MEM, armoury_apu_mem_index),
+	ARMOURY_PENDING(cores_performance, ARMOURY_STAGE_CORES, armoury_pending_perf_cores),
+	ARMOURY_PENDING(cores_efficiency, ARMOURY_STAGE_CORES, armoury_pending_power_cores),
+	ARMOURY_PENDING(panel_hd_mode, ARMOURY_STAGE_PANEL_HD, NULL),
+	ARMOURY_PENDING(gpu_mux_mode, ARMOURY_STAGE_GPU_MUX, NULL),
+};
+
+/* Notifies pollers of the pending_value of @idx, and of its current_value if @written */
+static void armoury_pending_notify(struct asus_armoury_priv *priv, int idx, bool written)
+{
+	struct kobject *kobj = &priv->fw_attr_kset->kobj;
+	struct armoury_pending *p;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_pending_attrs); i++) {
+		p = &armoury_pending_attrs[i];
+		if (p->stage != idx)
+			continue;
+
+		sysfs_notify(kobj, p->group->name, p->attr.attr.name);
+		if (written)
+			armoury_attr_notify(kobj, p->current_value);
+	}
+}
+
+/**
+ * armoury_stage_store() - Stage a value that needs a reboot.
+ * @priv: The driver instance.
+ * @dev_id: The WMI function ID the value is for.
+ * @value: The raw value to write.
+ * @mask: The bits of @value to stage, the others stay as staged before.
+ *
+ * With stage_reboot, values that only take effect after a reboot are kept
+ * here instead of written, and written together by armoury_stage_commit().
+ * Staging the value firmware already has reverts the change at no cost.
+ *
+ * Returns: 1 if staged, 0 if @dev_id is to be written now, or an error.
+ */
+static int armoury_stage_store(struct asus_armoury_priv *priv, u32 dev_id,
+			       u32 value, u32 mask)
+{
+	int idx = armoury_stage_find(priv, dev_id);
+	u32 fw, base;
+	int err;
+
+	if (!priv->staging || idx < 0)
+		return 0;
+
+	mutex_lock(&priv->mutex);
+	err = armoury_stage_firmware(priv, idx, &fw);
+	if (err) {
+		mutex_unlock(&priv->mutex);
+		return err;
+	}
+
+	base = test_bit(idx, &priv->staged) ? priv->staged_value[idx] : fw;
+	value = (base & ~mask) | (value & mask);
+	if (value == fw) {
+		__clear_bit(idx, &priv->staged);
+	} else {
+		priv->staged_value[idx] = value;
+		__set_bit(idx, &priv->staged);
+	}
+	mutex_unlock(&priv->mutex);
+
+	armoury_pending_notify(priv, idx, false);
+
+	return 1;
+}
+
+static int armoury_stage_write(struct asus_armoury_priv *priv, int idx, u32 value)
+{
+	u32 result;
+	int err;
+
+	lockdep_assert_held(&priv->mutex);
+
+	/* The dGPU or eGPU may have changed since the MUX change was staged */
+	if (idx == ARMOURY_STAGE_GPU_MUX) {
+		err = armoury_gpu_mux_check(priv, value);
+		if (err)
+			return err;
+	}
+
+	err = __armoury_set_devstate(priv, armoury_stage_dev_id(priv, idx), value,
+				     &result);
+	if (err == -EALREADY)
+		err = 0;
+	/* As in cores_current_value_store(), only n > 1 is a failure there */
+	else if (!err && (idx == ARMOURY_STAGE_CORES ? result > 1 : result != 1))
+		err = -EIO;
+
+	if (!err && idx == ARMOURY_STAGE_CORES)
+		armoury_cores_publish(priv, value);
+
+	return err;
+}
+
+/*
+ * Writes every staged value in the order of enum armoury_stage_idx. A value
+ * that fails is left staged and the rest are still written.
+ *
+ * Returns: 0, or the first error.
+ */
+static int armoury_stage_commit(struct asus_armoury_priv *priv)
+{
+	unsigned long staged, written = 0;
+	int idx, err, ret = 0;
+
+	mutex_lock(&priv->mutex);
+	staged = priv->staged;
+	for_each_set_bit(idx, &staged, ARMOURY_STAGE_COUNT) {
+		err = armoury_stage_write(priv, idx, priv->staged_value[idx]);
+		if (err) {
+			pr_warn("Failed to commit %s: %d\n", armoury_stage_names[idx], err);
+			ret = ret ?: err;
+			continue;
+		}
+		__clear_bit(idx, &priv->staged);
+		__set_bit(idx, &written);
+	}
+	mutex_unlock(&priv->mutex);
+
+	for_each_set_bit(idx, &written, ARMOURY_STAGE_COUNT)
+		armoury_pending_notify(priv, idx, true);
+	if (written)
+		asus_set_reboot_and_signal_event(priv);
+
+	return ret;
+}
+
+static ssize_t commit_store(struct kobject *kobj, struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	int err;
+
+	err = armoury_stage_commit(armoury_priv(kobj));
+
+	return err ?: count;
+}
+
+static struct kobj_attribute commit = __ATTR_WO(commit);
+
+static int armoury_stage_reboot(struct notifier_block *nb, unsigned long action,
+				void *data)
+{
+	struct asus_armoury_priv *priv = container_of(nb, struct asus_armoury_priv,
+						      reboot_nb);
+
+	armoury_stage_commit(priv);
+
+	return NOTIFY_DONE;
+}
+
+/* Whether asus_fw_attr_add() creates @group for @priv */
+static bool armoury_group_created(struct asus_armoury_priv *priv,
+				  const struct attribute_group *group)
+{
+	if (group == &mini_led_mode_attr_group)
+		return priv->mini_led_dev_id;
+	if (group == &gpu_mux_mode_attr_group)
+		return priv->gpu_mux_dev_id;
+	if (group == &gpu_mode_attr_group)
+		return armoury_gpu_mode_visible(priv);
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (armoury_attr_groups[i].attr_group == group)
+			return armoury_attr_group_visible(priv, i);
+	}
+
+	return false;
+}
+
+/* Adds the pending_value files and commit, and commits on the way to a reboot */
+static int armoury_stage_add(struct asus_armoury_priv *priv)
+{
+	struct kobject *kobj = &priv->fw_attr_kset->kobj;
+	struct armoury_pending *p;
+	int err;
+
+	if (!stage_reboot)
+		return 0;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_pending_attrs); i++) {
+		p = &armoury_pending_attrs[i];
+		if (!armoury_group_created(priv, p->group))
+			continue;
+
+		err = sysfs_add_file_to_group(kobj, &p->attr.attr, p->group->name);
+		if (err)
+			pr_warn("Failed to create pending_value for %s\n", p->group->name);
+	}
+
+	err = sysfs_create_file(kobj, &commit.attr);
+	if (err)
+		return err;
+
+	priv->reboot_nb.notifier_call = armoury_stage_reboot;
+	err = register_reboot_notifier(&priv->reboot_nb);
+	if (err) {
+		sysfs_remove_file(kobj, &commit.attr);
+		return err;
+	}
+
+	priv->staging = true;
+	return 0;
+}
+
+/* Values still staged are dropped, as if the machine was not rebooted */
+static void armoury_stage_remove(struct asus_armoury_priv *priv)
+{
+	if (!priv->staging)
+		return;
+
+	unregister_reboot_notifier(&priv->reboot_nb);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &commit.attr);
+	if (priv->staged)
+		dev_info(priv->fw_attr_dev, "Dropping %d staged changes\n",
+			 hweight_long(priv->staged));
+}
+
+/* Transactions ***************************************************************/
+
+/*
+ * Tunables that may be set together through the transaction attribute. The
+ * limits are those of the attribute itself. PL1 <= PL2 <= FPPT must hold for
+ * the values after the transaction, and is kept while it is applied.
+ */
+struct armoury_tunable {
+	struct kobj_attribute *attr;
+	u32 dev_id;
+	size_t value;
+	size_t def;
+	size_t min;
+	size_t max;
+};
+
+#define ARMOURY_TUNABLE(_attr, _wmi, _def, _min, _max) {		\
+	.attr = &attr_##_attr##_current_value,				\
+	.dev_id = _wmi,							\
+	.value = offsetof(struct rog_tunables, _attr),			\
+	.def = offsetof(struct rog_tunables, _def),			\
+	.min = offsetof(struct rog_tunables, _min),			\
+	.max = offsetof(struct rog_tunables, _max),			\
+}
+
+/* The PL1/PL2/FPPT chain comes first and in that order, see armoury_tx_apply() */
+enum armoury_tunable_idx {
+	ARMOURY_TUNABLE_PL1,
+	ARMOURY_TUNABLE_PL2,
+	ARMOURY_TUNABLE_FPPT,
+	ARMOURY_TUNABLE_APU_SPPT,
+	ARMOURY_TUNABLE_PLAT_SPPT,
+	ARMOURY_TUNABLE_NV_BOOST,
+	ARMOURY_TUNABLE_NV_TEMP,
+	ARMOURY_TUNABLE_DGPU_TGP,
+};
+
+static const struct armoury_tunable armoury_tunables[] = {
+	[ARMOURY_TUNABLE_PL1] = ARMOURY_TUNABLE(ppt_pl1_spl, ASUS_WMI_DEVID_PPT_PL1_SPL,
+						cpu_default, cpu_min, cpu_max),
+	[ARMOURY_TUNABLE_PL2] = ARMOURY_TUNABLE(ppt_pl2_sppt, ASUS_WMI_DEVID_PPT_PL2_SPPT,
+						cpu_default, cpu_min, cpu_max),
+	[ARMOURY_TUNABLE_FPPT] = ARMOURY_TUNABLE(ppt_fppt, ASUS_WMI_DEVID_PPT_FPPT,
+						 cpu_default, cpu_min, cpu_max),
+	[ARMOURY_TUNABLE_APU_SPPT] = ARMOURY_TUNABLE(ppt_apu_sppt, ASUS_WMI_DEVID_PPT_APU_SPPT,
+						     platform_default, platform_min, platform_max),
+	[ARMOURY_TUNABLE_PLAT_SPPT] = ARMOURY_TUNABLE(ppt_platform_sppt, ASUS_WMI_DEVID_PPT_PLAT_SPPT,
+						      platform_default, platform_min, platform_max),
+	[ARMOURY_TUNABLE_NV_BOOST] = ARMOURY_TUNABLE(nv_dynamic_boost, ASUS_WMI_DEVID_NV_DYN_BOOST,
+						     nv_boost_default, nv_boost_min, nv_boost_max),
+	[ARMOURY_TUNABLE_NV_TEMP] = ARMOURY_TUNABLE(nv_temp_target, ASUS_WMI_DEVID_NV_THERM_TARGET,
+						    nv_temp_default, nv_boost_min, nv_temp_max),
+	[ARMOURY_TUNABLE_DGPU_TGP] = ARMOURY_TUNABLE(dgpu_tgp, ASUS_WMI_DEVID_DGPU_SET_TGP,
+						     dgpu_tgp_default, dgpu_tgp_min, dgpu_tgp_max),
+};
+
+struct armoury_tx {
+	unsigned long staged;
+	u32 value[ARRAY_SIZE(armoury_tunables)];
+	u32 old[ARRAY_SIZE(armoury_tunables)];
+	u8 order[ARRAY_SIZE(armoury_tunables)];
+	int applied;
+};
+
+/*
+ * Stores the value firmware now has for tunable @idx, and tracks whether it
+ * differs from the default and so has to be restored after resume.
+ */
+static void armoury_tunable_update(struct asus_armoury_priv *priv, int idx, u32 value)
+{
+	const struct armoury_tunable *t = &armoury_tunables[idx];
+
+	armoury_tunables_store(priv, t->value, value);
+	assign_bit(idx, &priv->tunables_dirty,
+		   value != *armoury_tunable_val(armoury_tunables_locked(priv), t->def));
+}
+
+static int armoury_tunable_index(u32 dev_id)
+{
+	for (int i = 0; i < ARRAY_SIZE(armoury_tunables); i++) {
+		if (armoury_tunables[i].dev_id == dev_id)
+			return i;
+	}
+
+	return -ENOENT;
+}
+
+static void armoury_tunables_mark(struct asus_armoury_priv *priv, u32 dev_id,
+				  u32 value)
+{
+	int idx = armoury_tunable_index(dev_id);
+
+	if (idx >= 0)
+		armoury_tunable_update(priv, idx, value);
+}
+
+static bool armoury_tunable_in_range(struct rog_tunables *rog, int idx, u32 value)
+{
+	const struct armoury_tunable *t = &armoury_tunables[idx];
+
+	return value >= *armoury_tunable_val(rog, t->min) &&
+	       value <= *armoury_tunable_val(rog, t->max);
+}
+
+/* Checks @value against the limits of tunable @idx currently published */
+static bool armoury_tunable_valid(struct asus_armoury_priv *priv, int idx, u32 value)
+{
+	bool valid;
+
+	rcu_read_lock();
+	valid = armoury_tunable_in_range(rcu_dereference(priv->rog_tunables), idx, value);
+	rcu_read_unlock();
+
+	return valid;
+}
+
+static int armoury_tunable_find(const char *name)
+{
+	const char *group;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_tunables); i++) {
+		group = armoury_attr_group_name(armoury_tunables[i].attr);
+		if (group && !strcmp(group, name))
+			return i;
+	}
+
+	return -ENOENT;
+}
+
+/* Parses "name=value" pairs separated by spaces, commas or newlines */
+static int armoury_tx_parse(struct asus_armoury_priv *priv, char *buf,
+			    struct armoury_tx *tx)
+{
+	const struct armoury_tunable *t;
+	char *token, *value;
+	u32 val;
+	int idx, err;
+
+	while ((token = strsep(&buf, " ,\n"))) {
+		if (!*token)
+			continue;
+
+		value = strchr(token, '=');
+		if (!value)
+			return -EINVAL;
+		*value++ = '\0';
+
+		idx = armoury_tunable_find(token);
+		if (idx < 0 || test_bit(idx, &tx->staged))
+			return -EINVAL;
+		t = &armoury_tunables[idx];
+		if (!asus_wmi_is_present(priv, t->dev_id))
+			return -ENODEV;
+
+		err = kstrtouint(value, 10, &val);
+		if (err)
+			return err;
+		if (!armoury_tunable_valid(priv, idx, val))
+			return -EINVAL;
+
+		tx->value[idx] = val;
+		__set_bit(idx, &tx->staged);
+	}
+
+	return tx->staged ? 0 : -EINVAL;
+}
+
+/* The value of tunable @idx once @tx is applied */
+static u32 armoury_tx_value(struct asus_armoury_priv *priv, struct armoury_tx *tx,
+			    int idx)
+{
+	if (test_bit(idx, &tx->staged))
+		return tx->value[idx];
+
+	return *armoury_tunable_val(armoury_tunables_locked(priv),
+				    armoury_tunables[idx].value);
+}
+
+static bool armoury_tx_ordered(struct asus_armoury_priv *priv, struct armoury_tx *tx,
+			       int lo, int hi)
+{
+	if (!asus_wmi_is_present(priv, armoury_tunables[lo].dev_id) ||
+	    !asus_wmi_is_present(priv, armoury_tunables[hi].dev_id))
+		return true;
+
+	return armoury_tx_value(priv, tx, lo) <= armoury_tx_value(priv, tx, hi);
+}
+
+static int armoury_tx_validate(struct asus_armoury_priv *priv, struct armoury_tx *tx)
+{
+	if (!armoury_tx_ordered(priv, tx, ARMOURY_TUNABLE_PL1, ARMOURY_TUNABLE_PL2) ||
+	    !armoury_tx_ordered(priv, tx, ARMOURY_TUNABLE_PL2, ARMOURY_TUNABLE_FPPT) ||
+	    !armoury_tx_ordered(priv, tx, ARMOURY_TUNABLE_PL1, ARMOURY_TUNABLE_FPPT))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int armoury_tx_set(struct asus_armoury_priv *priv, int idx, u32 value)
+{
+	const struct armoury_tunable *t = &armoury_tunables[idx];
+	u32 result;
+	int err;
+
+	err = __armoury_set_devstate(priv, t->dev_id, value, &result);
+	if (err == -EALREADY)
+		err = 0;
+	else if (!err && result != 1)
+		err = -EIO;
+	if (err)
+		return err;
+
+	armoury_tunable_update(priv, idx, value);
+	return 0;
+}
+
+/* Restores the old values of those applied by armoury_tx_apply(), in reverse */
+static void armoury_tx_rollback(struct asus_armoury_priv *priv, struct armoury_tx *tx)
+{
+	int idx;
+
+	lockdep_assert_held(&priv->mutex);
+
+	while (tx->applied--) {
+		idx = tx->order[tx->applied];
+		if (armoury_tx_set(priv, idx, tx->old[idx]))
+			pr_err("Failed to roll back %s\n",
+			       armoury_attr_group_name(armoury_tunables[idx].attr));
+	}
+}
+
+/*
+ * Lowered values are applied first going up the table, then raised ones going
+ * down it. Every intermediate state of the PL1 <= PL2 <= FPPT chain then holds
+ * the lower of the old and new value for each limit, which keeps the order.
+ * On failure the values applied so far are restored.
+ */
+static int armoury_tx_apply(struct asus_armoury_priv *priv, struct armoury_tx *tx)
+{
+	int n = 0, idx, err;
+
+	lockdep_assert_held(&priv->mutex);
+
+	for_each_set_bit(idx, &tx->staged, ARRAY_SIZE(armoury_tunables)) {
+		tx->old[idx] = *armoury_tunable_val(armoury_tunables_locked(priv),
+						    armoury_tunables[idx].value);
+		if (tx->value[idx] < tx->old[idx])
+			tx->order[n++] = idx;
+	}
+	for (idx = ARRAY_SIZE(armoury_tunables) - 1; idx >= 0; idx--) {
+		if (test_bit(idx, &tx->staged) && tx->value[idx] >= tx->old[idx])
+			tx->order[n++] = idx;
+	}
+
+	for (tx->applied = 0; tx->applied < n; tx->applied++) {
+		idx = tx->order[tx->applied];
+		err = armoury_tx_set(priv, idx, tx->value[idx]);
+		if (err) {
+			pr_err("Failed to set %s in transaction: %d\n",
+			       armoury_attr_group_name(armoury_tunables[idx].attr), err);
+			armoury_tx_rollback(priv, tx);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/* Notifies pollers of every value @tx changed, returns true if there were any */
+static bool armoury_tx_notify(struct asus_armoury_priv *priv, struct armoury_tx *tx)
+{
+	bool changed = false;
+	int idx;
+
+	for_each_set_bit(idx, &tx->staged, ARRAY_SIZE(armoury_tunables)) {
+		if (tx->value[idx] == tx->old[idx])
+			continue;
+		armoury_attr_notify(&priv->fw_attr_kset->kobj, armoury_tunables[idx].attr);
+		changed = true;
+	}
+
+	return changed;
+}
+
+/*
+ * Writing "ppt_pl1_spl=60 ppt_pl2_sppt=80 ..." sets all listed tunables at
+ * once, or none of them. Pollers of each changed current_value are notified
+ * after the whole set is applied, with a single change uevent for it.
+ */
+static ssize_t transaction_store(struct kobject *kobj, struct kobj_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_tx tx = {};
+	char *tmp;
+	int err;
+
+	tmp = kstrndup(buf, count, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	err = armoury_tx_parse(priv, tmp, &tx);
+	kfree(tmp);
+	if (err)
+		return err;
+
+	armoury_coalesce_flush(priv);
+
+	mutex_lock(&priv->mutex);
+	err = armoury_tx_validate(priv, &tx);
+	if (!err)
+		err = armoury_tx_apply(priv, &tx);
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	if (armoury_tx_notify(priv, &tx))
+		kobject_uevent(&priv->fw_attr_dev->kobj, KOBJ_CHANGE);
+
+	return count;
+}
+
+static struct kobj_attribute transaction = __ATTR_WO(transaction);
+
+/* Write coalescing ***********************************************************/
+
+/*
+ * With coalesce_quiet_ms set, stores to the tunables only stage the value and
+ * return. The latest value of each is written once no store came for the
+ * quiet period, or coalesce_max_ms after the first one held back. They are
+ * written as a transaction: a set breaking the PL1 <= PL2 <= FPPT order is
+ * dropped, the order is kept while they are applied, and a failure leaves
+ * none of them applied.
+ */
+static bool armoury_coalesce_store(struct asus_armoury_priv *priv, u32 dev_id,
+				   u32 value)
+{
+	unsigned int quiet_ms = READ_ONCE(coalesce_quiet_ms);
+	unsigned long delay, deadline;
+	int idx;
+
+	if (!quiet_ms)
+		return false;
+
+	idx = armoury_tunable_index(dev_id);
+	if (idx < 0)
+		return false;
+
+	spin_lock(&priv->coalesce_lock);
+	if (!priv->coalesce->staged)
+		priv->coalesce_since = jiffies;
+	if (test_and_set_bit(idx, &priv->coalesce->staged))
+		armoury_stat_inc(priv, armoury_devid_index(dev_id), absorbed);
+	priv->coalesce->value[idx] = value;
+
+	deadline = priv->coalesce_since + msecs_to_jiffies(READ_ONCE(coalesce_max_ms));
+	delay = msecs_to_jiffies(quiet_ms);
+	if (time_after(jiffies + delay, deadline))
+		delay = time_after(deadline, jiffies) ? deadline - jiffies : 0;
+	mod_delayed_work(system_wq, &priv->coalesce_work, delay);
+	spin_unlock(&priv->coalesce_lock);
+
+	return true;
+}
+
+static void armoury_coalesce_work(struct work_struct *work)
+{
+	struct asus_armoury_priv *priv = container_of(to_delayed_work(work),
+						      struct asus_armoury_priv,
+						      coalesce_work);
+	struct armoury_tx tx;
+	int err;
+
+	spin_lock(&priv->coalesce_lock);
+	tx = *priv->coalesce;
+	priv->coalesce->staged = 0;
+	spin_unlock(&priv->coalesce_lock);
+
+	if (!tx.staged)
+		return;
+
+	/* Checked as a whole, the stores were only in range one by one */
+	mutex_lock(&priv->mutex);
+	err = armoury_tx_validate(priv, &tx);
+	if (!err)
+		err = armoury_tx_apply(priv, &tx);
+	mutex_unlock(&priv->mutex);
+	if (err) {
+		dev_warn(priv->fw_attr_dev, "Failed to write held back stores: %d\n", err);
+		return;
+	}
+
+	if (armoury_tx_notify(priv, &tx))
+		kobject_uevent(&priv->fw_attr_dev->kobj, KOBJ_CHANGE);
+}
+
+/* Writes out any held back stores before returning */
+static void armoury_coalesce_flush(struct asus_armoury_priv *priv)
+{
+	flush_delayed_work(&priv->coalesce_work);
+}
+
+static ssize_t coalesce_flush_store(struct kobject *kobj, struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	armoury_coalesce_flush(armoury_priv(kobj));
+	return count;
+}
+
+static struct kobj_attribute coalesce_flush = __ATTR_WO(coalesce_flush);
+
+/* Profiles *******************************************************************/
+
+/*
+ * Named sets of tunables, made under /sys/kernel/config/asus-armoury/. Each
+ * value is checked against the limits of this model when written, so that
+ * applying the profile only has to check the PL1 <= PL2 <= FPPT order against
+ * what is in effect. A profile may be bound to one platform_profile level, and
+ * is then applied on every instance when that level is selected.
+ */
+struct armoury_profile {
+	struct config_item item;
+	struct list_head node;
+
+	struct armoury_tx tx;
+	int mcu_powersave;
+	int platform_profile;
+};
+
+static const char * const armoury_platform_profiles[] = {
+	[PLATFORM_PROFILE_LOW_POWER] = "low-power",
+	[PLATFORM_PROFILE_COOL] = "cool",
+	[PLATFORM_PROFILE_QUIET] = "quiet",
+	[PLATFORM_PROFILE_BALANCED] = "balanced",
+	[PLATFORM_PROFILE_BALANCED_PERFORMANCE] = "balanced-performance",
+	[PLATFORM_PROFILE_PERFORMANCE] = "performance",
+};
+
+/* Limits every profile value is checked against, from init_rog_tunables() */
+static struct rog_tunables armoury_profile_limits;
+
+static DEFINE_MUTEX(armoury_profiles_lock);
+static LIST_HEAD(armoury_profiles);
+
+static void armoury_platform_profile_update(void);
+
+static struct armoury_profile *to_armoury_profile(struct config_item *item)
+{
+	return container_of(item, struct armoury_profile, item);
+}
+
+/* Copies the values of the profile @name, or the one bound to @level if NULL */
+static int armoury_profile_get(const char *name, int level, struct armoury_tx *tx,
+			       int *mcu_powersave)
+{
+	struct armoury_profile *profile;
+	int err = -ENOENT;
+
+	mutex_lock(&armoury_profiles_lock);
+	list_for_each_entry(profile, &armoury_profiles, node) {
+		if (name ? sysfs_streq(config_item_name(&profile->item), name) :
+			   profile->platform_profile == level) {
+			*tx = profile->tx;
+			*mcu_powersave = profile->mcu_powersave;
+			err = 0;
+			break;
+		}
+	}
+	mutex_unlock(&armoury_profiles_lock);
+
+	return err;
+}
+
+/*
+ * Applies the profile values this instance has, all or none of them. Values
+ * already in effect are skipped by the write shadow.
+ */
+static int armoury_profile_apply(struct asus_armoury_priv *priv,
+				 struct armoury_tx *tx, int mcu_powersave)
+{
+	bool mcu_changed = false;
+	u32 result;
+	int idx, err;
+
+	for_each_set_bit(idx, &tx->staged, ARRAY_SIZE(armoury_tunables)) {
+		if (!asus_wmi_is_present(priv, armoury_tunables[idx].dev_id))
+			__clear_bit(idx, &tx->staged);
+	}
+	if (mcu_powersave >= 0 &&
+	    (!asus_wmi_is_present(priv, ASUS_WMI_DEVID_MCU_POWERSAVE) ||
+	     dmi_check_system(asus_rog_ally_device)))
+		mcu_powersave = -1;
+
+	armoury_coalesce_flush(priv);
+
+	mutex_lock(&priv->mutex);
+	err = armoury_tx_validate(priv, tx);
+	if (!err)
+		err = armoury_tx_apply(priv, tx);
+	if (!err && mcu_powersave >= 0) {
+		err = __armoury_set_devstate(priv, ASUS_WMI_DEVID_MCU_POWERSAVE,
+					     mcu_powersave, &result);
+		if (err == -EALREADY)
+			err = 0;
+		else if (!err && result != 1)
+			err = -EIO;
+		else if (!err)
+			mcu_changed = true;
+		if (err)
+			armoury_tx_rollback(priv, tx);
+	}
+	mutex_unlock(&priv->mutex);
+	if (err)
+		return err;
+
+	if (mcu_changed)
+		armoury_attr_notify(&priv->fw_attr_kset->kobj,
+				    &attr_mcu_powersave_current_value);
+	if (armoury_tx_notify(priv, tx) || mcu_changed)
+		kobject_uevent(&priv->fw_attr_dev->kobj, KOBJ_CHANGE);
+
+	return 0;
+}
+
+static ssize_t apply_profile_store(struct kobject *kobj, struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_tx tx;
+	int mcu_powersave;
+	int err;
+
+	err = armoury_profile_get(buf, -1, &tx, &mcu_powersave);
+	if (err)
+		return err;
+
+	err = armoury_profile_apply(priv, &tx, mcu_powersave);
+	if (err)
+		return err;
+
+	return count;
+}
+
+static struct kobj_attribute apply_profile = __ATTR_WO(apply_profile);
+
+static ssize_t armoury_profile_value_show(struct config_item *item, char *page, int idx)
+{
+	struct armoury_profile *profile = to_armoury_profile(item);
+	ssize_t ret;
+
+	mutex_lock(&armoury_profiles_lock);
+	if (test_bit(idx, &profile->tx.staged))
+		ret = sysfs_emit(page, "%u\n", profile->tx.value[idx]);
+	else
+		ret = sysfs_emit(page, "\n");
+	mutex_unlock(&armoury_profiles_lock);
+
+	return ret;
+}
+
+/* An empty write drops the value from the profile */
+static ssize_t armoury_profile_value_store(struct config_item *item, const char *page,
+					   size_t count, int idx)
+{
+	struct armoury_profile *profile = to_armoury_profile(item);
+	struct armoury_tx tx;
+	u32 value;
+	int err;
+
+	mutex_lock(&armoury_profiles_lock);
+	tx = profile->tx;
+	if (sysfs_streq(page, "")) {
+		__clear_bit(idx, &tx.staged);
+	} else {
+		err = kstrtouint(page, 10, &value);
+		if (err)
+			goto out_unlock;
+		err = -EINVAL;
+		if (!armoury_tunable_in_range(&armoury_profile_limits, idx, value))
+			goto out_unlock;
+		tx.value[idx] = value;
+		__set_bit(idx, &tx.staged);
+	}
+
+	/* The order of the limits the profile sets itself can be checked now */
+	err = -EINVAL;
+	for (int lo = ARMOURY_TUNABLE_PL1; lo < ARMOURY_TUNABLE_FPPT; lo++) {
+		for (int hi = lo + 1; hi <= ARMOURY_TUNABLE_FPPT; hi++) {
+			if (test_bit(lo, &tx.staged) && test_bit(hi, &tx.staged) &&
+			    tx.value[lo] > tx.value[hi])
+				goto out_unlock;
+		}
+	}
+
+	profile->tx = tx;
+	err = 0;
+out_unlock:
+	mutex_unlock(&armoury_profiles_lock);
+
+	return err ?: count;
+}
+
+#define ARMOURY_PROFILE_ATTR(_name, _idx)					\
+static ssize_t armoury_profile_##_name##_show(struct config_item *item,		\
+					       char *page)			\
+{										\
+	return armoury_profile_value_show(item, page, _idx);			\
+}										\
+static ssize_t armoury_profile_##_name##_store(struct config_item *item,	\
+						const char *page, size_t count)	\
+{										\
+	return armoury_profile_value_store(item, page, count, _idx);		\
+}										\
+CONFIGFS_ATTR(armoury_profile_, _name)
+
+ARMOURY_PROFILE_ATTR(ppt_pl1_spl, ARMOURY_TUNABLE_PL1);
+ARMOURY_PROFILE_ATTR(ppt_pl2_sppt, ARMOURY_TUNABLE_PL2);
+ARMOURY_PROFILE_ATTR(ppt_fppt, ARMOURY_TUNABLE_FPPT);
+ARMOURY_PROFILE_ATTR(ppt_apu_sppt, ARMOURY_TUNABLE_APU_SPPT);
+ARMOURY_PROFILE_ATTR(ppt_platform_sppt, ARMOURY_TUNABLE_PLAT_SPPT);
+ARMOURY_PROFILE_ATTR(nv_dynamic_boost, ARMOURY_TUNABLE_NV_BOOST);
+ARMOURY_PROFILE_ATTR(nv_temp_target, ARMOURY_TUNABLE_NV_TEMP);
+ARMOURY_PROFILE_ATTR(dgpu_tgp, ARMOURY_TUNABLE_DGPU_TGP);
+
+static ssize_t armoury_profile_mcu_powersave_show(struct config_item *item, char *page)
+{
+	int value = READ_ONCE(to_armoury_profile(item)->mcu_powersave);
+
+	if (value < 0)
+		return sysfs_emit(page, "\n");
+
+	return sysfs_emit(page, "%d\n", value);
+}
+
+static ssize_t armoury_profile_mcu_powersave_store(struct config_item *item,
+						   const char *page, size_t count)
+{
+	bool value;
+	int err;
+
+	if (sysfs_streq(page, "")) {
+		WRITE_ONCE(to_armoury_profile(item)->mcu_powersave, -1);
+		return count;
+	}
+
+	err = kstrtobool(page, &value);
+	if (err)
+		return err;
+
+	WRITE_ONCE(to_armoury_profile(item)->mcu_powersave, value);
+	return count;
+}
+CONFIGFS_ATTR(armoury_profile_, mcu_powersave);
+
+static ssize_t armoury_profile_platform_profile_show(struct config_item *item,
+						     char *page)
+{
+	int level = READ_ONCE(to_armoury_profile(item)->platform_profile);
+
+	if (level < 0)
+		return sysfs_emit(page, "\n");
+
+	return sysfs_emit(page, "%s\n", armoury_platform_profiles[level]);
+}
+
+/* Each level may be bound to one profile at most */
+static ssize_t armoury_profile_platform_profile_store(struct config_item *item,
+						      const char *page, size_t count)
+{
+	struct armoury_profile *profile = to_armoury_profile(item);
+	struct armoury_profile *other;
+	int level = -1;
+	int err = 0;
+
+	if (!sysfs_streq(page, "")) {
+		level = sysfs_match_string(armoury_platform_profiles, page);
+		if (level < 0)
+			return level;
+	}
+
+	mutex_lock(&armoury_profiles_lock);
+	list_for_each_entry(other, &armoury_profiles, node) {
+		if (level >= 0 && other != profile && other->platform_profile == level)
+			err = -EBUSY;
+	}
+	if (!err)
+		WRITE_ONCE(profile->platform_profile, level);
+	mutex_unlock(&armoury_profiles_lock);
+
+	if (err)
+		return err;
+
+	armoury_platform_profile_update();
+	return count;
+}
+CONFIGFS_ATTR(armoury_profile_, platform_profile);
+
+static struct configfs_attribute *armoury_profile_attrs[] = {
+	&armoury_profile_attr_ppt_pl1_spl,
+	&armoury_profile_attr_ppt_pl2_sppt,
+	&armoury_profile_attr_ppt_fppt,
+	&armoury_profile_attr_ppt_apu_sppt,
+	&armoury_profile_attr_ppt_platform_sppt,
+	&armoury_profile_attr_nv_dynamic_boost,
+	&armoury_profile_attr_nv_temp_target,
+	&armoury_profile_attr_dgpu_tgp,
+	&armoury_profile_attr_mcu_powersave,
+	&armoury_profile_attr_platform_profile,
+	NULL,
+};
+
+static void armoury_profile_release(struct config_item *item)
+{
+	kfree(to_armoury_profile(item));
+}
+
+static struct configfs_item_operations armoury_profile_item_ops = {
+	.release = armoury_profile_release,
+};
+
+static const struct config_item_type armoury_profile_type = {
+	.ct_item_ops = &armoury_profile_item_ops,
+	.ct_attrs = armoury_profile_attrs,
+	.ct_owner = THIS_MODULE,
+};
+
+static struct config_item *armoury_profiles_make_item(struct config_group *group,
+						      const char *name)
+{
+	struct armoury_profile *profile;
+
+	profile = kzalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile)
+		return ERR_PTR(-ENOMEM);
+
+	config_item_init_type_name(&profile->item, name, &armoury_profile_type);
+	profile->mcu_powersave = -1;
+	profile->platform_profile = -1;
+
+	mutex_lock(&armoury_profiles_lock);
+	list_add_tail(&profile->node, &armoury_profiles);
+	mutex_unlock(&armoury_profiles_lock);
+
+	return &profile->item;
+}
+
+static void armoury_profiles_drop_item(struct config_group *group,
+				       struct config_item *item)
+{
+	mutex_lock(&armoury_profiles_lock);
+	list_del(&to_armoury_profile(item)->node);
+	mutex_unlock(&armoury_profiles_lock);
+
+	armoury_platform_profile_update();
+
+	config_item_put(item);
+}
+
+static struct configfs_group_operations armoury_profiles_group_ops = {
+	.make_item = armoury_profiles_make_item,
+	.drop_item = armoury_profiles_drop_item,
+};
+
+static const struct config_item_type armoury_profiles_type = {
+	.ct_group_ops = &armoury_profiles_group_ops,
+	.ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem armoury_profiles_subsys;
+
+static void init_rog_tunables(struct rog_tunables *rog);
+
+static int armoury_profiles_register(void)
+{
+	init_rog_tunables(&armoury_profile_limits);
+
+	config_group_init_type_name(&armoury_profiles_subsys.su_group, DRIVER_NAME,
+				    &armoury_profiles_type);
+	mutex_init(&armoury_profiles_subsys.su_mutex);
+
+	return configfs_register_subsystem(&armoury_profiles_subsys);
+}
+
+static void armoury_profiles_unregister(void)
+{
+	configfs_unregister_subsystem(&armoury_profiles_subsys);
+}
+
+/*
+ * platform_profile handler of an instance. It is only registered while a
+ * profile is bound to a level. The legacy platform_profile offers the levels
+ * all handlers have and reads "custom" when they disagree, so the handler
+ * offers every level and follows the one selected, leaving the choice and
+ * the level in effect to asus-wmi. Lock order is armoury_pp_lock, then the
+ * platform_profile core's lock, then armoury_profiles_lock.
+ */
+static DEFINE_MUTEX(armoury_pp_lock);
+static LIST_HEAD(armoury_pp_instances);
+static bool armoury_pp_bound;
+
+static int armoury_platform_profile_probe(void *drvdata, unsigned long *choices)
+{
+	for (int i = 0; i < ARRAY_SIZE(armoury_platform_profiles); i++)
+		set_bit(i, choices);
+
+	return 0;
+}
+
+/*
+ * The level asus-wmi reports for its throttle thermal policy, which is in
+ * effect until a level is selected. Balanced if there is no such policy.
+ */
+static enum platform_profile_option armoury_platform_profile_current(struct asus_armoury_priv *priv)
+{
+	u32 policy;
+
+	if (!__armoury_get_devstate(priv, ASUS_WMI_DEVID_THROTTLE_THERMAL_POLICY,
+				    &policy, false)) {
+		switch (policy & ~ASUS_WMI_DSTS_PRESENCE_BIT) {
+		case 1:
+			return PLATFORM_PROFILE_PERFORMANCE;
+		case 2:
+			return PLATFORM_PROFILE_QUIET;
+		}
+	} else if (!__armoury_get_devstate(priv, ASUS_WMI_DEVID_THROTTLE_THERMAL_POLICY_VIVO,
+					   &policy, false)) {
+		/* Vivobooks swap silent and overboost */
+		switch (policy & ~ASUS_WMI_DSTS_PRESENCE_BIT) {
+		case 1:
+			return PLATFORM_PROFILE_QUIET;
+		case 2:
+			return PLATFORM_PROFILE_PERFORMANCE;
+		}
+	}
+
+	return PLATFORM_PROFILE_BALANCED;
+}
+
+static int armoury_platform_profile_get(struct device *dev,
+					enum platform_profile_option *profile)
+{
+	struct asus_armoury_priv *priv = dev_get_drvdata(dev);
+
+	*profile = READ_ONCE(priv->platform_profile);
+	return 0;
+}
+
+static int armoury_platform_profile_set(struct device *dev,
+					enum platform_profile_option profile)
+{
+	struct asus_armoury_priv *priv = dev_get_drvdata(dev);
+	struct armoury_tx tx;
+	int mcu_powersave;
+	int err;
+
+	/* The other handlers, asus-wmi's among them, may have reset the tunables */
+	armoury_shadow_invalidate_all(priv);
+
+	if (!armoury_profile_get(NULL, profile, &tx, &mcu_powersave)) {
+		err = armoury_profile_apply(priv, &tx, mcu_powersave);
+		if (err)
+			return err;
+	}
+
+	WRITE_ONCE(priv->platform_profile, profile);
+	return 0;
+}
+
+static const struct platform_profile_ops armoury_platform_profile_ops = {
+	.probe = armoury_platform_profile_probe,
+	.profile_get = armoury_platform_profile_get,
+	.profile_set = armoury_platform_profile_set,
+};
+
+static void armoury_platform_profile_register(struct asus_armoury_priv *priv)
+{
+	lockdep_assert_held(&armoury_pp_lock);
+
+	if (!armoury_pp_bound)
+		return;
+
+	priv->platform_profile = armoury_platform_profile_current(priv);
+	priv->ppdev = platform_profile_register(priv->fw_attr_dev, DRIVER_NAME, priv,
+						&armoury_platform_profile_ops);
+	if (IS_ERR(priv->ppdev)) {
+		dev_warn(priv->fw_attr_dev, "Failed to register platform_profile: %ld\n",
+			 PTR_ERR(priv->ppdev));
+		priv->ppdev = NULL;
+	}
+}
+
+static void armoury_platform_profile_unregister(struct asus_armoury_priv *priv)
+{
+	lockdep_assert_held(&armoury_pp_lock);
+
+	if (priv->ppdev)
+		platform_profile_remove(priv->ppdev);
+	priv->ppdev = NULL;
+}
+
+static void armoury_platform_profile_update(void)
+{
+	struct armoury_profile *profile;
+	struct asus_armoury_priv *priv;
+	bool bound = false;
+
+	mutex_lock(&armoury_pp_lock);
+
+	mutex_lock(&armoury_profiles_lock);
+	list_for_each_entry(profile, &armoury_profiles, node) {
+		if (profile->platform_profile >= 0)
+			bound = true;
+	}
+	mutex_unlock(&armoury_profiles_lock);
+
+	if (bound != armoury_pp_bound) {
+		armoury_pp_bound = bound;
+		list_for_each_entry(priv, &armoury_pp_instances, pp_node) {
+			if (bound)
+				armoury_platform_profile_register(priv);
+			else
+				armoury_platform_profile_unregister(priv);
+		}
+	}
+
+	mutex_unlock(&armoury_pp_lock);
+}
+
+static void armoury_platform_profile_add(struct asus_armoury_priv *priv)
+{
+	mutex_lock(&armoury_pp_lock);
+	list_add_tail(&priv->pp_node, &armoury_pp_instances);
+	armoury_platform_profile_register(priv);
+	mutex_unlock(&armoury_pp_lock);
+}
+
+static void armoury_platform_profile_remove(struct asus_armoury_priv *priv)
+{
+	mutex_lock(&armoury_pp_lock);
+	list_del(&priv->pp_node);
+	armoury_platform_profile_unregister(priv);
+	mutex_unlock(&armoury_pp_lock);
+}
+
+/* Profile blobs **************************************************************/
+
+/*
+ * Tunable values in binary form for provisioning, read and written through
+ * the attributes/profile_blob file. The header is followed by @count entries,
+ * all little endian. @crc is the CRC-32 of the entries as zlib computes it,
+ * and each tunable may have one entry, keyed by its WMI dev_id.
+ */
+#define ARMOURY_BLOB_MAGIC	0x4c424141	/* "AABL" */
+#define ARMOURY_BLOB_VERSION	1
+#define ARMOURY_BLOB_DIR	"asus-armoury/"
+
+struct armoury_blob_hdr {
+	__le32 magic;
+	__le16 version;
+	__le16 count;
+	__le32 crc;
+} __packed;
+
+struct armoury_blob_entry {
+	__le32 dev_id;
+	__le32 value;
+} __packed;
+
+struct armoury_blob {
+	struct armoury_blob_hdr hdr;
+	struct armoury_blob_entry entries[ARRAY_SIZE(armoury_tunables)];
+} __packed;
+
+static bool boot_blob;
+module_param(boot_blob, bool, 0444);
+MODULE_PARM_DESC(boot_blob,
+	"Apply the profile blob " ARMOURY_BLOB_DIR "<product>.bin when probing");
+
+/*
+ * Stages the values of the blob in @tx. All of its tunables have to be present
+ * on this instance and their values within its limits, so that a blob made for
+ * another model is refused rather than applied in part.
+ */
+static int armoury_blob_parse(struct asus_armoury_priv *priv, const u8 *data,
+			      size_t size, struct armoury_tx *tx)
+{
+	const struct armoury_blob *blob = (const struct armoury_blob *)data;
+	const struct armoury_blob_entry *entry;
+	unsigned int count;
+	u32 val;
+	int idx;
+
+	if (size < sizeof(blob->hdr) ||
+	    le32_to_cpu(blob->hdr.magic) != ARMOURY_BLOB_MAGIC)
+		return -EINVAL;
+	if (le16_to_cpu(blob->hdr.version) != ARMOURY_BLOB_VERSION)
+		return -EOPNOTSUPP;
+
+	count = le16_to_cpu(blob->hdr.count);
+	if (!count || count > ARRAY_SIZE(armoury_tunables) ||
+	    size != sizeof(blob->hdr) + count * sizeof(*entry))
+		return -EINVAL;
+	if (~crc32(~0, blob->entries, count * sizeof(*entry)) !=
+	    le32_to_cpu(blob->hdr.crc))
+		return -EBADMSG;
+
+	for (entry = blob->entries; entry < blob->entries + count; entry++) {
+		idx = armoury_tunable_index(le32_to_cpu(entry->dev_id));
+		if (idx < 0 || test_bit(idx, &tx->staged))
+			return -EINVAL;
+		if (!asus_wmi_is_present(priv, armoury_tunables[idx].dev_id))
+			return -ENODEV;
+
+		val = le32_to_cpu(entry->value);
+		if (!armoury_tunable_valid(priv, idx, val))
+			return -EINVAL;
+
+		tx->value[idx] = val;
+		__set_bit(idx, &tx->staged);
+	}
+
+	return 0;
+}
+
+/* Fills @blob with the current values of the tunables present, returns its size */
+static size_t armoury_blob_fill(struct asus_armoury_priv *priv,
+				struct armoury_blob *blob)
+{
+	const struct armoury_tunable *t;
+	struct rog_tunables *rog;
+	unsigned int count = 0;
+	u32 val;
+
+	rcu_read_lock();
+	rog = rcu_dereference(priv->rog_tunables);
+	for (int i = 0; i < ARRAY_SIZE(armoury_tunables); i++) {
+		t = &armoury_tunables[i];
+		if (!asus_wmi_is_present(priv, t->dev_id))
+			continue;
+
+		val = *armoury_tunable_val(rog, t->value);
+		blob->entries[count].dev_id = cpu_to_le32(t->dev_id);
+		blob->entries[count].value = cpu_to_le32(val);
+		count++;
+	}
+	rcu_read_unlock();
+
+	blob->hdr.magic = cpu_to_le32(ARMOURY_BLOB_MAGIC);
+	blob->hdr.version = cpu_to_le16(ARMOURY_BLOB_VERSION);
+	blob->hdr.count = cpu_to_le16(count);
+	blob->hdr.crc = cpu_to_le32(~crc32(~0, blob->entries,
+					   count * sizeof(blob->entries[0])));
+
+	return sizeof(blob->hdr) + count * sizeof(blob->entries[0]);
+}
+
+static ssize_t profile_blob_read(struct file *filp, struct kobject *kobj,
+				 struct bin_attribute *attr, char *buf,
+				 loff_t off, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_blob blob;
+	size_t size;
+
+	size = armoury_blob_fill(priv, &blob);
+
+	return memory_read_from_buffer(buf, count, &off, &blob, size);
+}
+
+/* The blob has to be written in one go, and is applied as a whole or not at all */
+static ssize_t profile_blob_write(struct file *filp, struct kobject *kobj,
+				  struct bin_attribute *attr, char *buf,
+				  loff_t off, size_t count)
+{
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_tx tx = {};
+	int err;
+
+	if (off)
+		return -EINVAL;
+
+	/* A bin_attribute does not go through armoury_attr_store() */
+	err = armoury_fw_budget_take(true);
+	if (err)
+		return err;
+
+	err = armoury_blob_parse(priv, buf, count, &tx);
+	if (err)
+		return err;
+
+	err = armoury_profile_apply(priv, &tx, -1);
+	if (err)
+		return err;
+
+	return count;
+}
+
+static BIN_ATTR_RW(profile_blob, sizeof(struct armoury_blob));
+
+static void armoury_blob_loaded(const struct firmware *fw, void *context)
+{
+	struct asus_armoury_priv *priv = context;
+	struct armoury_tx tx = {};
+	int err;
+
+	/* A missing blob has already been logged by the firmware loader */
+	if (!fw)
+		goto out;
+
+	err = armoury_blob_parse(priv, fw->data, fw->size, &tx);
+	if (!err)
+		err = armoury_profile_apply(priv, &tx, -1);
+	if (err)
+		dev_warn(priv->fw_attr_dev, "Failed to apply the boot profile blob: %d\n", err);
+	else
+		dev_info(priv->fw_attr_dev, "Applied the boot profile blob\n");
+
+	release_firmware(fw);
+out:
+	complete(&priv->blob_done);
+}
+
+/*
+ * Requests ARMOURY_BLOB_DIR "<DMI product name>.bin", with any spaces and
+ * slashes in the name replaced by underscores. It is applied once the firmware
+ * loader finds it, which for a driver loaded from the initramfs is before the
+ * root filesystem is mounted if the blob was packed alongside it.
+ */
+static void armoury_blob_request(struct asus_armoury_priv *priv)
+{
+	const char *product = dmi_get_system_info(DMI_PRODUCT_NAME);
+	char *name;
+	int err;
+
+	if (!boot_blob || !product)
+		goto out;
+
+	name = kasprintf(GFP_KERNEL, ARMOURY_BLOB_DIR "%s.bin", product);
+	if (!name)
+		goto out;
+	strreplace(name + strlen(ARMOURY_BLOB_DIR), '/', '_');
+	strreplace(name, ' ', '_');
+
+	err = request_firmware_nowait(THIS_MODULE, FW_ACTION_NOUEVENT, name,
+				      priv->fw_attr_dev, GFP_KERNEL, priv,
+				      armoury_blob_loaded);
+	kfree(name);
+	if (!err)
+		return;
+
+	dev_warn(priv->fw_attr_dev, "Failed to request the boot profile blob: %d\n", err);
+out:
+	complete(&priv->blob_done);
+}
+
+/* Asynchronous stores ********************************************************/
+
+static bool async_stores;
+module_param(async_stores, bool, 0444);
+MODULE_PARM_DESC(async_stores,
+		 "Queue current_value stores once validated, reporting the outcome in a status file");
+
+enum armoury_async_state {
+	ARMOURY_ASYNC_IDLE = 1,
+	ARMOURY_ASYNC_QUEUED,
+	ARMOURY_ASYNC_RUNNING,
+	ARMOURY_ASYNC_DONE,
+};
+
+/*
+ * The status file of a group and the state of the last store queued to its
+ * current_value: an armoury_async_state, or the negative errno it failed with.
+ * Earlier stores still queued run in order but no longer report.
+ */
+struct armoury_async_slot {
+	struct kobj_attribute status;
+	const struct attribute_group *group;
+	struct kobj_attribute *current_value;
+	unsigned int seq;
+	int state;
+};
+
+struct armoury_async_req {
+	struct work_struct work;
+	struct asus_armoury_priv *priv;
+	struct armoury_async_slot *slot;
+	unsigned int seq;
+	size_t count;
+	char buf[];
+};
+
+/*
+ * Calls the store of @kattr between the store tracepoints. The store is
+ * admitted against the firmware call budget here, before it may take
+ * priv->mutex, except for commit which must not be held back.
+ */
+static ssize_t armoury_attr_store(struct kobject *kobj, struct kobj_attribute *kattr,
+				  const char *buf, size_t count)
+{
+	int id = armoury_priv(kobj)->id;
+	ssize_t ret = -EIO;
+	int err;
+
+	if (kattr != &commit) {
+		err = armoury_fw_budget_take(true);
+		if (err)
+			return err;
+	}
+
+	trace_asus_armoury_attr_store_enter(id, kattr);
+	if (kattr->store)
+		ret = kattr->store(kobj, kattr, buf, count);
+	trace_asus_armoury_attr_store_exit(id, kattr, ret);
+
+	return ret;
+}
+
+static struct kobj_attribute *armoury_group_attr(const struct attribute_group *group,
+						 const char *name)
+{
+	for (struct attribute **a = group->attrs; *a; a++) {
+		if (!strcmp((*a)->name, name))
+			return container_of(*a, struct kobj_attribute, attr);
+	}
+
+	return NULL;
+}
+
+static int armoury_group_show_u32(struct kobject *kobj,
+				  const struct attribute_group *group,
+				  const char *name, char *page, u32 *value)
+{
+	struct kobj_attribute *kattr = armoury_group_attr(group, name);
+	ssize_t ret;
+
+	if (!kattr)
+		return -ENOENT;
+
+	ret = kattr->show(kobj, kattr, page);
+	if (ret < 0)
+		return ret;
+
+	return kstrtou32(page, 10, value);
+}
+
+/*
+ * The synchronous part of an asynchronous store: @buf has to be one of the
+ * possible_values of the group, or within its min_value and max_value. What
+ * only the store itself can check is reported through the status file.
+ */
+static int armoury_async_validate(struct kobject *kobj,
+				  const struct attribute_group *group,
+				  const char *buf)
+{
+	struct kobj_attribute *possible = armoury_group_attr(group, "possible_values");
+	char *page, *values, *token;
+	u32 value, min, max, v;
+	int err;
+
+	err = kstrtou32(buf, 10, &value);
+	if (err)
+		return err;
+
+	page = (char *)get_zeroed_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	if (possible) {
+		err = possible->show(kobj, possible, page);
+		if (err >= 0) {
+			err = -EINVAL;
+			values = page;
+			while ((token = strsep(&values, ";\n"))) {
+				if (*token && !kstrtou32(token, 10, &v) && v == value) {
+					err = 0;
+					break;
+				}
+			}
+		}
+	} else {
+		err = armoury_group_show_u32(kobj, group, "min_value", page, &min);
+		if (!err)
+			err = armoury_group_show_u32(kobj, group, "max_value", page, &max);
+		if (!err && (value < min || value > max))
+			err = -EINVAL;
+	}
+
+	free_page((unsigned long)page);
+	return err;
+}
+
+static void armoury_async_set(struct asus_armoury_priv *priv,
+			      struct armoury_async_slot *slot, unsigned int seq,
+			      int state)
+{
+	spin_lock(&priv->async_lock);
+	if (slot->seq != seq) {
+		spin_unlock(&priv->async_lock);
+		return;
+	}
+	slot->state = state;
+	spin_unlock(&priv->async_lock);
+
+	sysfs_notify(&priv->fw_attr_kset->kobj, slot->group->name, "status");
+}
+
+static void armoury_async_work(struct work_struct *work)
+{
+	struct armoury_async_req *req = container_of(work, struct armoury_async_req, work);
+	struct asus_armoury_priv *priv = req->priv;
+	ssize_t ret;
+
+	armoury_async_set(priv, req->slot, req->seq, ARMOURY_ASYNC_RUNNING);
+	ret = armoury_attr_store(&priv->fw_attr_kset->kobj, req->slot->current_value,
+				 req->buf, req->count);
+	armoury_async_set(priv, req->slot, req->seq,
+			  ret < 0 ? ret : ARMOURY_ASYNC_DONE);
+
+	kfree(req);
+}
+
+static struct armoury_async_slot *armoury_async_find(struct asus_armoury_priv *priv,
+						     struct kobj_attribute *kattr)
+{
+	int count = smp_load_acquire(&priv->async_count);
+
+	for (int i = 0; i < count; i++) {
+		if (priv->async_slots[i].current_value == kattr)
+			return &priv->async_slots[i];
+	}
+
+	return NULL;
+}
+
+static ssize_t armoury_async_submit(struct asus_armoury_priv *priv,
+				    struct armoury_async_slot *slot,
+				    const char *buf, size_t count)
+{
+	struct kobject *kobj = &priv->fw_attr_kset->kobj;
+	struct armoury_async_req *req;
+	int err;
+
+	err = armoury_async_validate(kobj, slot->group, buf);
+	if (err)
+		return err;
+
+	req = kzalloc(struct_size(req, buf, count + 1), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	INIT_WORK(&req->work, armoury_async_work);
+	req->priv = priv;
+	req->slot = slot;
+	req->count = count;
+	memcpy(req->buf, buf, count);
+
+	spin_lock(&priv->async_lock);
+	if (priv->async_closing) {
+		spin_unlock(&priv->async_lock);
+		kfree(req);
+		return -ENODEV;
+	}
+	req->seq = ++slot->seq;
+	slot->state = ARMOURY_ASYNC_QUEUED;
+	queue_work(priv->async_wq, &req->work);
+	spin_unlock(&priv->async_lock);
+
+	sysfs_notify(kobj, slot->group->name, "status");
+
+	return count;
+}
+
+static ssize_t armoury_async_status_show(struct kobject *kobj,
+					 struct kobj_attribute *attr, char *buf)
+{
+	struct armoury_async_slot *slot = container_of(attr, struct armoury_async_slot,
+						       status);
+	int state = READ_ONCE(slot->state);
+
+	switch (state) {
+	case ARMOURY_ASYNC_IDLE:
+		return sysfs_emit(buf, "idle\n");
+	case ARMOURY_ASYNC_QUEUED:
+		return sysfs_emit(buf, "queued\n");
+	case ARMOURY_ASYNC_RUNNING:
+		return sysfs_emit(buf, "running\n");
+	case ARMOURY_ASYNC_DONE:
+		return sysfs_emit(buf, "done\n");
+	}
+
+	return sysfs_emit(buf, "error %d\n", state);
+}
+
+static int armoury_async_slot_add(struct asus_armoury_priv *priv,
+				  const struct attribute_group *group)
+{
+	struct armoury_async_slot *slot = &priv->async_slots[priv->async_count];
+	struct kobj_attribute *current_value = armoury_group_attr(group, "current_value");
+	int err;
+
+	if (!current_value || !current_value->store)
+		return 0;
+
+	sysfs_attr_init(&slot->status.attr);
+	slot->status.attr.name = "status";
+	slot->status.attr.mode = 0444;
+	slot->status.show = armoury_async_status_show;
+	slot->group = group;
+	slot->current_value = current_value;
+	slot->state = ARMOURY_ASYNC_IDLE;
+
+	err = sysfs_add_file_to_group(&priv->fw_attr_kset->kobj, &slot->status.attr,
+				      group->name);
+	if (err)
+		return err;
+
+	/* Stores may already come in, they look the slot up by the count */
+	smp_store_release(&priv->async_count, priv->async_count + 1);
+	return 0;
+}
+
+/* Groups outside armoury_attr_groups[] that may have a writable current_value */
+static const struct attribute_group *armoury_async_extra_groups[] = {
+	&mini_led_mode_attr_group,
+	&gpu_mux_mode_attr_group,
+	&gpu_mode_attr_group,
+};
+
+/* Adds a status file to every group shown with a writable current_value */
+static int armoury_async_add(struct asus_armoury_priv *priv)
+{
+	const struct attribute_group *group;
+	int err = 0;
+
+	if (!async_stores)
+		return 0;
+
+	priv->async_slots = kcalloc(ARRAY_SIZE(armoury_attr_groups) +
+				    ARRAY_SIZE(armoury_async_extra_groups),
+				    sizeof(*priv->async_slots), GFP_KERNEL);
+	if (!priv->async_slots)
+		return -ENOMEM;
+
+	priv->async_wq = alloc_ordered_workqueue("%s-async", 0,
+						 dev_name(priv->fw_attr_dev));
+	if (!priv->async_wq) {
+		kfree(priv->async_slots);
+		priv->async_slots = NULL;
+		return -ENOMEM;
+	}
+
+	for (int i = 0; !err && i < ARRAY_SIZE(armoury_async_extra_groups); i++) {
+		group = armoury_async_extra_groups[i];
+		if (armoury_group_created(priv, group))
+			err = armoury_async_slot_add(priv, group);
+	}
+	for (int i = 0; !err && i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (armoury_attr_group_visible(priv, i))
+			err = armoury_async_slot_add(priv, armoury_attr_groups[i].attr_group);
+	}
+	if (!err)
+		return 0;
+
+	/* Back to synchronous stores, destroy_workqueue() runs any already queued */
+	for (int i = priv->async_count - 1; i >= 0; i--) {
+		smp_store_release(&priv->async_count, i);
+		sysfs_remove_file_from_group(&priv->fw_attr_kset->kobj,
+					     &priv->async_slots[i].status.attr,
+					     priv->async_slots[i].group->name);
+	}
+	destroy_workqueue(priv->async_wq);
+	priv->async_wq = NULL;
+	kfree(priv->async_slots);
+	priv->async_slots = NULL;
+
+	return err;
+}
+
+/*
+ * Refuses further stores and waits for the queued ones, which need the
+ * attributes kset. The status files go with the kset.
+ */
+static void armoury_async_remove(struct asus_armoury_priv *priv)
+{
+	if (!priv->async_wq)
+		return;
+
+	spin_lock(&priv->async_lock);
+	priv->async_closing = true;
+	spin_unlock(&priv->async_lock);
+
+	destroy_workqueue(priv->async_wq);
+	priv->async_wq = NULL;
+}
+
+/*
+ * kobj_sysfs_ops for the attributes kset, with tracepoints around every show
+ * and store.
+ */
+static ssize_t armoury_kset_attr_show(struct kobject *kobj, struct attribute *attr,
+				      char *buf)
+{
+	struct kobj_attribute *kattr = container_of(attr, struct kobj_attribute, attr);
+	int id = armoury_priv(kobj)->id;
+	ssize_t ret = -EIO;
+
+	trace_asus_armoury_attr_show_enter(id, kattr);
+	if (kattr->show)
+		ret = kattr->show(kobj, kattr, buf);
+	trace_asus_armoury_attr_show_exit(id, kattr, ret);
+
+	return ret;
+}
+
+static ssize_t armoury_kset_attr_store(struct kobject *kobj, struct attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct kobj_attribute *kattr = container_of(attr, struct kobj_attribute, attr);
+	struct asus_armoury_priv *priv = armoury_priv(kobj);
+	struct armoury_async_slot *slot = armoury_async_find(priv, kattr);
+
+	if (slot)
+		return armoury_async_submit(priv, slot, buf, count);
+
+	return armoury_attr_store(kobj, kattr, buf, count);
+}
+
+static const struct sysfs_ops armoury_kset_sysfs_ops = {
+	.show = armoury_kset_attr_show,
+	.store = armoury_kset_attr_store,
+};
+
+static void armoury_kset_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct kset, kobj));
+}
+
+static const struct kobj_type armoury_kset_ktype = {
+	.sysfs_ops = &armoury_kset_sysfs_ops,
+	.release = armoury_kset_release,
+};
+
+/* As kset_create_and_add(), but with armoury_kset_ktype */
+static struct kset *armoury_kset_create_and_add(const char *name,
+						struct kobject *parent)
+{
+	struct kset *kset;
+
+	kset = kzalloc(sizeof(*kset), GFP_KERNEL);
+	if (!kset)
+		return NULL;
+
+	if (kobject_set_name(&kset->kobj, "%s", name)) {
+		kfree(kset);
+		return NULL;
+	}
+	kset->kobj.parent = parent;
+	kset->kobj.ktype = &armoury_kset_ktype;
+
+	if (kset_register(kset)) {
+		kfree(kset);
+		return NULL;
+	}
+
+	return kset;
+}
+
+static int asus_fw_attr_add(struct asus_armoury_priv *priv)
+{
+	int err;
+
+	err = fw_attributes_class_get(&fw_attr_class);
+	if (err)
+		return err;
+
+	if (priv->id)
+		priv->fw_attr_dev = device_create(fw_attr_class, NULL, MKDEV(0, 0),
+			priv, "%s-%d", DRIVER_NAME, priv->id);
+	else
+		priv->fw_attr_dev = device_create(fw_attr_class, NULL, MKDEV(0, 0),
+			priv, "%s", DRIVER_NAME);
+
+	if (IS_ERR(priv->fw_attr_dev)) {
+		err = PTR_ERR(priv->fw_attr_dev);
+		goto fail_class_created;
+	}
+
+	priv->fw_attr_kset = armoury_kset_create_and_add("attributes",
+				&priv->fw_attr_dev->kobj);
+	if (!priv->fw_attr_kset) {
+		err = -ENOMEM;
+		pr_debug("Failed to create and add attributes\n");
+		goto err_destroy_classdev;
+	}
+
+	err = sysfs_create_file(&priv->fw_attr_kset->kobj, &pending_reboot.attr);
+	if (!err)
+		err = sysfs_create_file(&priv->fw_attr_kset->kobj, &snapshot.attr);
+	if (!err)
+		err = sysfs_create_file(&priv->fw_attr_kset->kobj, &transaction.attr);
+	if (!err)
+		err = sysfs_create_file(&priv->fw_attr_kset->kobj, &apply_profile.attr);
+	if (!err)
+		err = sysfs_create_file(&priv->fw_attr_kset->kobj, &coalesce_flush.attr);
+	if (!err)
+		err = sysfs_create_bin_file(&priv->fw_attr_kset->kobj, &bin_attr_profile_blob);
+	if (err) {
+		pr_warn("Failed to create sysfs level attributes\n");
+		goto err_destroy_kset;
+	}
+
+	err = 0;
+	priv->mini_led_dev_id = 0;
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_MINI_LED_MODE)) {
+		priv->mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE;
+		err = sysfs_create_group(&priv->fw_attr_kset->kobj,
+			&mini_led_mode_attr_group);
+	} else if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_MINI_LED_MODE2)) {
+		priv->mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE2;
+		err = sysfs_create_group(&priv->fw_attr_kset->kobj,
+			&mini_led_mode_attr_group);
+	}
+	if (err)
+		pr_warn("Failed to create sysfs-group for mini_led\n");
+
+	err = 0;
+	priv->gpu_mux_dev_id = 0;
+	if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_GPU_MUX)) {
+		priv->gpu_mux_dev_id = ASUS_WMI_DEVID_GPU_MUX;
+		err = sysfs_create_group(&priv->fw_attr_kset->kobj, &gpu_mux_mode_attr_group);
+	} else if (asus_wmi_is_present(priv, ASUS_WMI_DEVID_GPU_MUX_VIVO)) {
+		priv->gpu_mux_dev_id = ASUS_WMI_DEVID_GPU_MUX_VIVO;
+		err = sysfs_create_group(&priv->fw_attr_kset->kobj, &gpu_mux_mode_attr_group);
+	}
+	if (err)
+		pr_warn("Failed to create sysfs-group for gpu_mux\n");
+
+	if (armoury_gpu_mode_visible(priv) &&
+	    sysfs_create_group(&priv->fw_attr_kset->kobj, &gpu_mode_attr_group))
+		pr_warn("Failed to create sysfs-group for gpu_mode\n");
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (!armoury_attr_group_visible(priv, i))
+			continue;
+
+		err = sysfs_create_group(&priv->fw_attr_kset->kobj,
+			armoury_attr_groups[i].attr_group);
+		if (err)
+			pr_warn("Failed to create sysfs-group for %s\n",
+				armoury_attr_groups[i].attr_group->name);
+		else
+			pr_debug("Created sysfs-group for %s\n",
+				armoury_attr_groups[i].attr_group->name);
+	}
+
+	return 0;
+
+err_destroy_kset:
+	kset_unregister(priv->fw_attr_kset);
+
+err_destroy_classdev:
+	device_unregister(priv->fw_attr_dev);
+
+fail_class_created:
+	fw_attributes_class_put();
+	return err;
+}
+
+/*
+ * Not done under priv->mutex, removing the kset waits for any show or store
+ * still running, and those may need the mutex themselves.
+ */
+static void asus_fw_attr_remove(struct asus_armoury_priv *priv)
+{
+	sysfs_remove_bin_file(&priv->fw_attr_kset->kobj, &bin_attr_profile_blob);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &coalesce_flush.attr);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &apply_profile.attr);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &transaction.attr);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &snapshot.attr);
+	sysfs_remove_file(&priv->fw_attr_kset->kobj, &pending_reboot.attr);
+	kset_unregister(priv->fw_attr_kset);
+	device_unregister(priv->fw_attr_dev);
+	fw_attributes_class_put();
+}
+
+/* Character device ***********************************************************/
+
+/*
+ * Shared by the open files of an instance's misc device. @priv is cleared
+ * under @lock when the instance is removed, the state page is only freed
+ * with the last reference so that existing mappings stay valid.
+ */
+struct armoury_chardev {
+	struct kref kref;
+	struct rw_semaphore lock;
+	struct asus_armoury_priv *priv;
+	struct armoury_state_page *state;
+};
+
+static void armoury_chardev_release(struct kref *kref)
+{
+	struct armoury_chardev *cdev = container_of(kref, struct armoury_chardev, kref);
+
+	free_page((unsigned long)cdev->state);
+	kfree(cdev);
+}
+
+/*
+ * misc_open() calls this under the misc lock, which misc_deregister() takes
+ * too, so the instance is still there.
+ */
+static int armoury_chardev_open(struct inode *inode, struct file *file)
+{
+	struct asus_armoury_priv *priv = container_of(file->private_data,
+						      struct asus_armoury_priv,
+						      miscdev);
+
+	kref_get(&priv->chardev->kref);
+	file->private_data = priv->chardev;
+
+	return nonseekable_open(inode, file);
+}
+
+static int armoury_chardev_close(struct inode *inode, struct file *file)
+{
+	struct armoury_chardev *cdev = file->private_data;
+
+	kref_put(&cdev->kref, armoury_chardev_release);
+	return 0;
+}
+
+static int armoury_chardev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct armoury_chardev *cdev = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(cdev->state));
+}
+
+/*
+ * The current_value of the attribute for @dev_id, if the instance has one.
+ * Device IDs shared by several attributes, such as that of the core counts,
+ * are not reachable this way.
+ */
+static struct kobj_attribute *armoury_chardev_attr(struct asus_armoury_priv *priv,
+						   u32 dev_id)
+{
+	const struct attribute_group *group = NULL;
+	int idx = -1;
+
+	if (priv->mini_led_dev_id && dev_id == priv->mini_led_dev_id) {
+		group = &mini_led_mode_attr_group;
+	} else if (priv->gpu_mux_dev_id && dev_id == priv->gpu_mux_dev_id) {
+		group = &gpu_mux_mode_attr_group;
+	} else {
+		for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+			if (armoury_attr_groups[i].wmi_devid != dev_id)
+				continue;
+			if (idx >= 0)
+				return NULL;
+			idx = i;
+		}
+		if (idx < 0 || !armoury_attr_group_visible(priv, idx))
+			return NULL;
+		group = armoury_attr_groups[idx].attr_group;
+	}
+
+	for (struct attribute **a = group->attrs; *a; a++) {
+		if (!strcmp((*a)->name, "current_value"))
+			return container_of(*a, struct kobj_attribute, attr);
+	}
+
+	return NULL;
+}
+
+/*
+ * Each entry goes through the show or store of its current_value, so values,
+ * validation and errors are exactly those of sysfs. @page is a page for show.
+ */
+static int armoury_chardev_get(struct asus_armoury_priv *priv,
+			       struct kobj_attribute *attr, char *page, u32 *value)
+{
+	ssize_t ret;
+
+	ret = armoury_kset_attr_show(&priv->fw_attr_kset->kobj, &attr->attr, page);
+	if (ret < 0)
+		return ret;
+
+	return kstrtou32(page, 10, value);
+}
+
+static int armoury_chardev_set(struct asus_armoury_priv *priv,
+			       struct kobj_attribute *attr, u32 value)
+{
+	char buf[12];
+	ssize_t ret;
+	int len;
+
+	/* As opening a read-only sysfs file for writing fails */
+	if (!attr->store)
+		return -EACCES;
+
+	/* Never queued with async_stores, the entry's status is that of the store */
+	len = snprintf(buf, sizeof(buf), "%u", value);
+	ret = armoury_attr_store(&priv->fw_attr_kset->kobj, attr, buf, len);
+
+	return ret < 0 ? ret : 0;
+}
+
+static long armoury_chardev_batch(struct asus_armoury_priv *priv, bool set,
+				  struct asus_armoury_batch *batch)
+{
+	struct asus_armoury_entry *entries, *e;
+	struct kobj_attribute *attr;
+	char *page = NULL;
+	long ret = 0;
+
+	if (batch->flags || !batch->count || batch->count > ASUS_ARMOURY_BATCH_MAX)
+		return -EINVAL;
+
+	entries = memdup_array_user(u64_to_user_ptr(batch->entries), batch->count,
+				    sizeof(*entries));
+	if (IS_ERR(entries))
+		return PTR_ERR(entries);
+
+	if (!set) {
+		page = (char *)get_zeroed_page(GFP_KERNEL);
+		if (!page) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	for (e = entries; e < entries + batch->count; e++) {
+		attr = armoury_chardev_attr(priv, e->dev_id);
+		if (e->reserved)
+			e->status = -EINVAL;
+		else if (!attr)
+			e->status = -ENODEV;
+		else if (set)
+			e->status = armoury_chardev_set(priv, attr, e->value);
+		else
+			e->status = armoury_chardev_get(priv, attr, page, &e->value);
+	}
+
+	if (copy_to_user(u64_to_user_ptr(batch->entries), entries,
+			 batch->count * sizeof(*entries)))
+		ret = -EFAULT;
+
+	free_page((unsigned long)page);
+out_free:
+	kfree(entries);
+	return ret;
+}
+
+static long armoury_chardev_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct armoury_chardev *cdev = file->private_data;
+	struct asus_armoury_batch batch;
+	long ret;
+
+	if (cmd != ASUS_ARMOURY_IOC_GET && cmd != ASUS_ARMOURY_IOC_SET)
+		return -ENOTTY;
+	if (cmd == ASUS_ARMOURY_IOC_SET && !(file->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+		return -EFAULT;
+
+	down_read(&cdev->lock);
+	if (cdev->priv)
+		ret = armoury_chardev_batch(cdev->priv, cmd == ASUS_ARMOURY_IOC_SET, &batch);
+	else
+		ret = -ENODEV;
+	up_read(&cdev->lock);
+
+	return ret;
+}
+
+static const struct file_operations armoury_chardev_fops = {
+	.owner = THIS_MODULE,
+	.open = armoury_chardev_open,
+	.release = armoury_chardev_close,
+	.mmap = armoury_chardev_mmap,
+	.unlocked_ioctl = armoury_chardev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
+};
+
+/* Named after the class device, so /dev/asus-armoury for the first instance */
+static int armoury_chardev_add(struct asus_armoury_priv *priv)
+{
+	struct armoury_chardev *cdev;
+	int err;
+
+	cdev = kzalloc(sizeof(*cdev), GFP_KERNEL);
+	if (!cdev)
+		return -ENOMEM;
+
+	kref_init(&cdev->kref);
+	init_rwsem(&cdev->lock);
+	cdev->priv = priv;
+	cdev->state = priv->state;
+
+	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
+	priv->miscdev.name = dev_name(priv->fw_attr_dev);
+	priv->miscdev.fops = &armoury_chardev_fops;
+	priv->miscdev.mode = 0644;
+	priv->chardev = cdev;
+
+	err = misc_register(&priv->miscdev);
+	if (err) {
+		priv->chardev = NULL;
+		kfree(cdev);
+	}
+
+	return err;
+}
+
+/*
+ * Detaches the open files from the instance, waiting for any ioctl still
+ * running. The state page goes with the last of those files, or now.
+ */
+static void armoury_chardev_remove(struct asus_armoury_priv *priv)
+{
+	struct armoury_chardev *cdev = priv->chardev;
+
+	misc_deregister(&priv->miscdev);
+
+	down_write(&cdev->lock);
+	cdev->priv = NULL;
+	up_write(&cdev->lock);
+}
+
+static void armoury_chardev_put(struct asus_armoury_priv *priv)
+{
+	kref_put(&priv->chardev->kref, armoury_chardev_release);
+}
+
+/* Probe / remove *************************************************************/
+
+/* Set up the min/max and defaults for ROG tunables */
+static void init_rog_tunables(struct rog_tunables *rog)
+{
+	const char *product;
+	u32 max_boost = NVIDIA_BOOST_MAX;
+	u32 cpu_default = PPT_CPU_LIMIT_DEFAULT;
+	u32 cpu_max = PPT_CPU_LIMIT_MAX;
+	u32 platform_default = PPT_PLATFORM_DEFAULT;
+	u32 platform_max = PPT_PLATFORM_MAX;
+
+	/*
+	 * ASUS product_name contains everything required, e.g,
+	 * "ROG Flow X16 GV601VV_GV601VV_00185149B"
+	 */
+	product = dmi_get_system_info(DMI_PRODUCT_NAME);
+	if (!product)
+		product = "";
+
+	if (strstr(product, "GA402R")) {
+		cpu_default = 125;
+	} else if (strstr(product, "13QY")) {
+		cpu_max = 250;
+	} else if (strstr(product, "X13")) {
+		cpu_max = 75;
+		cpu_default = 50;
+	} else if (strstr(product, "RC71")
+		|| strstr(product, "RC72")) {
+		cpu_max = 50;
+		cpu_default = 30;
+	} else if (strstr(product, "G814")
+		|| strstr(product, "G614")
+		|| strstr(product, "G834")
+		|| strstr(product, "G634")) {
+		cpu_max = 175;
+	} else if (strstr(product, "GA402X")
+		|| strstr(product, "GA403")
+		|| strstr(product, "FA507N")
+		|| strstr(product, "FA507X")
+		|| strstr(product, "FA707N")
+		|| strstr(product, "FA707X")) {
+		cpu_max = 90;
+	}
+
+	if (strstr(product, "GZ301ZE"))
+		max_boost = 5;
+	else if (strstr(product, "FX507ZC4"))
+		max_boost = 15;
+	else if (strstr(product, "GU605"))
+		max_boost = 20;
+
+	/* ensure defaults for tunables */
+	rog->cpu_default = cpu_default;
+	rog->cpu_min = PPT_CPU_LIMIT_MIN;
+	rog->cpu_max = cpu_max;
+
+	rog->platform_default = platform_default;
+	rog->platform_max = PPT_PLATFORM_MIN;
+	rog->platform_max = platform_max;
+
+	rog->ppt_pl1_spl = cpu_default;
+	rog->ppt_pl2_sppt = cpu_default;
+	rog->ppt_apu_sppt = cpu_default;
+
+	rog->ppt_platform_sppt = platform_default;
+	rog->ppt_fppt = cpu_default;
+
+	rog->nv_boost_default = NVIDIA_BOOST_MAX;
+	rog->nv_boost_max = NVIDIA_BOOST_MIN;
+	rog->nv_boost_max = max_boost;
+	rog->nv_dynamic_boost = NVIDIA_BOOST_MIN;
+
+	rog->nv_temp_default = NVIDIA_TEMP_MAX;
+	rog->nv_temp_max = NVIDIA_TEMP_MIN;
+	rog->nv_temp_max = NVIDIA_TEMP_MAX;
+	rog->nv_temp_target = NVIDIA_TEMP_MIN;
+
+	rog->dgpu_tgp_default = NVIDIA_POWER_DEFAULT;
+	rog->dgpu_tgp_min = NVIDIA_POWER_MIN;
+	rog->dgpu_tgp_max = NVIDIA_POWER_MAX;
+	rog->dgpu_tgp = NVIDIA_POWER_MAX;
+
+}
+
+/* The attribute a device ID is read or written for, to name it in debugfs */
+static const char *armoury_devid_attr_name(u32 dev_id)
+{
+	switch (dev_id) {
+	case ASUS_WMI_DEVID_MINI_LED_MODE:
+	case ASUS_WMI_DEVID_MINI_LED_MODE2:
+		return mini_led_mode_attr_group.name;
+	case ASUS_WMI_DEVID_GPU_MUX:
+	case ASUS_WMI_DEVID_GPU_MUX_VIVO:
+		return gpu_mux_mode_attr_group.name;
+	case ASUS_WMI_DEVID_CORES:
+	case ASUS_WMI_DEVID_CORES_MAX:
+		return "cores";
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
+		if (armoury_attr_groups[i].wmi_devid == dev_id)
+			return armoury_attr_groups[i].attr_group->name;
+	}
+
+	return "-";
+}
+
+static void armoury_stats_sum(struct asus_armoury_priv *priv, int idx,
+			      struct armoury_devid_stats *sum)
+{
+	u64 *dst = (u64 *)sum;
+	const u64 *src;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		src = (const u64 *)&per_cpu_ptr(priv->stats, cpu)->devid[idx];
+		for (int i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+			dst[i] += src[i];
+	}
+}
+
+/* debugfs stats/counters: one line per device ID */
+static int counters_show(struct seq_file *m, void *unused)
+{
+	struct asus_armoury_priv *priv = m->private;
+	struct armoury_devid_stats sum;
+
+	seq_puts(m, "dev_id attribute reads writes failures bad_results cache_hits coalesced elided absorbed smis\n");
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		armoury_stats_sum(priv, i, &sum);
+		seq_printf(m, "0x%08x %s %llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
+			   armoury_devids[i], armoury_devid_attr_name(armoury_devids[i]),
+			   sum.reads, sum.writes, sum.failures, sum.bad_results,
+			   sum.cache_hits, sum.coalesced, sum.elided, sum.absorbed, sum.smis);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(counters);
+
+/*
+ * debugfs stats/{dsts,devs}_latency_us: one line per device ID with the call
+ * count of each histogram bucket, the header gives the lower bound in us.
+ */
+static void armoury_latency_show(struct seq_file *m, bool devs)
+{
+	struct asus_armoury_priv *priv = m->private;
+	struct armoury_devid_stats sum;
+	const u64 *lat;
+
+	seq_puts(m, "dev_id attribute 0");
+	for (int b = 1; b < ARMOURY_LAT_BUCKETS; b++)
+		seq_printf(m, " %lu", BIT(b - 1));
+	seq_putc(m, '\n');
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		armoury_stats_sum(priv, i, &sum);
+		lat = devs ? sum.devs_lat : sum.dsts_lat;
+
+		seq_printf(m, "0x%08x %s", armoury_devids[i],
+			   armoury_devid_attr_name(armoury_devids[i]));
+		for (int b = 0; b < ARMOURY_LAT_BUCKETS; b++)
+			seq_printf(m, " %llu", lat[b]);
+		seq_putc(m, '\n');
+	}
+}
+
+static int dsts_latency_us_show(struct seq_file *m, void *unused)
+{
+	armoury_latency_show(m, false);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(dsts_latency_us);
+
+static int devs_latency_us_show(struct seq_file *m, void *unused)
+{
+	armoury_latency_show(m, true);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(devs_latency_us);
+
+/* debugfs fw_budget: the machine wide budget, the same in every instance */
+static int fw_budget_show(struct seq_file *m, void *unused)
+{
+	typeof(armoury_fw_budget) budget;
+
+	spin_lock(&armoury_fw_budget_lock);
+	budget = armoury_fw_budget;
+	spin_unlock(&armoury_fw_budget_lock);
+
+	seq_printf(m, "window_calls: %u\n", budget.window_calls);
+	seq_printf(m, "window_stall_us: %llu\n", budget.window_stall_us);
+	seq_printf(m, "calls: %llu\n", budget.calls);
+	seq_printf(m, "stall_us: %llu\n", budget.stall_us);
+	seq_printf(m, "smis: %llu\n", budget.smis);
+	seq_printf(m, "smi_count_supported: %d\n", armoury_smi_count_supported);
+	seq_printf(m, "queued: %llu\n", budget.queued);
+	seq_printf(m, "rejected: %llu\n", budget.rejected);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fw_budget);
+
+/*
+ * debugfs wmi_trace: the trace as it was at open(), see
+ * struct armoury_wmi_trace_hdr. Writing anything empties the ring.
+ */
+struct armoury_wmi_trace_dump {
+	size_t len;
+	char data[];
+};
+
+static int wmi_trace_open(struct inode *inode, struct file *file)
+{
+	struct asus_armoury_priv *priv = inode->i_private;
+	struct armoury_wmi_trace *trace = priv->wmi_trace;
+	struct armoury_wmi_trace_dump *dump;
+	struct armoury_wmi_trace_hdr *hdr;
+	struct armoury_wmi_trace_rec *recs;
+	u32 first, tail;
+
+	dump = kvzalloc(struct_size(dump, data, sizeof(*hdr) +
+				    trace->size * sizeof(*recs)), GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
+
+	hdr = (struct armoury_wmi_trace_hdr *)dump->data;
+	recs = (struct armoury_wmi_trace_rec *)(hdr + 1);
+	hdr->magic = ARMOURY_WMI_TRACE_MAGIC;
+	hdr->version = ARMOURY_WMI_TRACE_VERSION;
+	hdr->rec_size = sizeof(*recs);
+
+	spin_lock(&trace->lock);
+	first = (trace->head + trace->size - trace->len) % trace->size;
+	tail = min(trace->len, trace->size - first);
+	memcpy(recs, &trace->recs[first], tail * sizeof(*recs));
+	memcpy(recs + tail, trace->recs, (trace->len - tail) * sizeof(*recs));
+	hdr->count = trace->len;
+	hdr->dropped = trace->dropped;
+	spin_unlock(&trace->lock);
+
+	dump->len = sizeof(*hdr) + hdr->count * sizeof(*recs);
+	file->private_data = dump;
+
+	return 0;
+}
+
+static ssize_t wmi_trace_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct armoury_wmi_trace_dump *dump = file->private_data;
+
+	return simple_read_from_buffer(ubuf, count, ppos, dump->data, dump->len);
+}
+
+static ssize_t wmi_trace_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	struct asus_armoury_priv *priv = file_inode(file)->i_private;
+	struct armoury_wmi_trace *trace = priv->wmi_trace;
+
+	spin_lock(&trace->lock);
+	trace->head = 0;
+	trace->len = 0;
+	trace->dropped = 0;
+	spin_unlock(&trace->lock);
+
+	return count;
+}
+
+static int wmi_trace_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations wmi_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = wmi_trace_open,
+	.read = wmi_trace_read,
+	.write = wmi_trace_write,
+	.llseek = default_llseek,
+	.release = wmi_trace_release,
+};
+
+static void asus_fw_debugfs_init(struct asus_armoury_priv *priv)
+{
+	struct dentry *stats;
+
+	priv->debugfs_root = debugfs_create_dir(dev_name(priv->fw_attr_dev), NULL);
+
+	debugfs_create_bool("cache_bypass", 0644, priv->debugfs_root,
+			    &priv->cache_bypass);
+	debugfs_create_u64("probe_us", 0444, priv->debugfs_root, &priv->probe_us);
+	debugfs_create_u32("probe_calls", 0444, priv->debugfs_root,
+			   &priv->probe_calls);
+	debugfs_create_u64("restore_us", 0444, priv->debugfs_root,
+			   &priv->restore_us);
+	debugfs_create_u32("restore_writes", 0444, priv->debugfs_root,
+			   &priv->restore_writes);
+
+	stats = debugfs_create_dir("stats", priv->debugfs_root);
+	debugfs_create_file("counters", 0444, stats, priv, &counters_fops);
+	debugfs_create_file("dsts_latency_us", 0444, stats, priv,
+			    &dsts_latency_us_fops);
+	debugfs_create_file("devs_latency_us", 0444, stats, priv,
+			    &devs_latency_us_fops);
+	debugfs_create_file("fw_budget", 0444, stats, NULL, &fw_budget_fops);
+
+	if (priv->wmi_trace)
+		debugfs_create_file("wmi_trace", 0644, priv->debugfs_root,
+				    priv, &wmi_trace_fops);
+}
+
+/*
+ * Publishes what probing found: the presence bits, and the tunables, whose
+ * values are not read back from firmware. Only device IDs already probed are
+ * marked present so that this costs no firmware calls.
+ */
+static void armoury_state_publish(struct asus_armoury_priv *priv)
+{
+	const struct armoury_tunable *t;
+	struct armoury_state_page *state;
+	u64 present = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		if (READ_ONCE(priv->devstate[i].probed) &&
+		    READ_ONCE(priv->devstate[i].present))
+			present |= BIT_ULL(i);
+	}
+
+	state = armoury_state_begin(priv);
+	state->present = present;
+	state->generation++;
+	armoury_state_end(priv);
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_tunables); i++) {
+		t = &armoury_tunables[i];
+		if (asus_wmi_is_present(priv, t->dev_id))
+			armoury_state_update(priv, t->dev_id,
+					     armoury_tunable_get(priv, t->value));
+	}
+}
+
+/*
+ * Firmware may reset tunables across suspend or hibernation. The ones set away
+ * from their default are written back from a workqueue so resume is not held
+ * up, lowered ones first going up the table and then raised ones going down it
+ * to keep the PL1 <= PL2 <= FPPT order, as in armoury_tx_apply().
+ */
+static void armoury_restore_one(struct asus_armoury_priv *priv, int idx)
+{
+	u32 value = *armoury_tunable_val(armoury_tunables_locked(priv),
+					 armoury_tunables[idx].value);
+
+	if (armoury_tx_set(priv, idx, value))
+		dev_warn(priv->fw_attr_dev, "Failed to restore %s\n",
+			 armoury_attr_group_name(armoury_tunables[idx].attr));
+	priv->restore_writes++;
+}
+
+static void armoury_restore_work(struct work_struct *work)
+{
+	struct asus_armoury_priv *priv = container_of(work, struct asus_armoury_priv,
+						      restore_work);
+	ktime_t start = ktime_get();
+	unsigned long dirty, lowered = 0;
+	struct rog_tunables *rog;
+	int idx;
+
+	mutex_lock(&priv->mutex);
+	priv->restore_writes = 0;
+	dirty = READ_ONCE(priv->tunables_dirty);
+	rog = armoury_tunables_locked(priv);
+	for_each_set_bit(idx, &dirty, ARRAY_SIZE(armoury_tunables)) {
+		if (*armoury_tunable_val(rog, armoury_tunables[idx].value) <
+		    *armoury_tunable_val(rog, armoury_tunables[idx].def))
+			__set_bit(idx, &lowered);
+	}
+
+	for_each_set_bit(idx, &lowered, ARRAY_SIZE(armoury_tunables))
+		armoury_restore_one(priv, idx);
+	for (idx = ARRAY_SIZE(armoury_tunables) - 1; idx >= 0; idx--) {
+		if (test_bit(idx, &dirty) && !test_bit(idx, &lowered))
+			armoury_restore_one(priv, idx);
+	}
+	mutex_unlock(&priv->mutex);
+
+	priv->restore_us = ktime_us_delta(ktime_get(), start);
+	dev_dbg(priv->fw_attr_dev, "restored %u tunables in %llu us\n",
+		priv->restore_writes, priv->restore_us);
+}
+
+static int asus_armoury_suspend(struct device *dev)
+{
+	struct asus_armoury_priv *priv = dev_get_drvdata(dev);
+
+	armoury_coalesce_flush(priv);
+	cancel_work_sync(&priv->restore_work);
+	return 0;
+}
+
+static int asus_armoury_resume(struct device *dev)
+{
+	struct asus_armoury_priv *priv = dev_get_drvdata(dev);
+
+	/* Neither what we read nor what we wrote can be trusted any more */
+	armoury_devstate_invalidate_all(priv);
+	armoury_shadow_invalidate_all(priv);
+
+	if (READ_ONCE(priv->tunables_dirty))
+		queue_work(system_unbound_wq, &priv->restore_work);
+
+	return 0;
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(asus_armoury_pm_ops, asus_armoury_suspend,
+				asus_armoury_resume);
+
+/* Firmware events ************************************************************/
+
+#define ASUS_WMI_EVENT_MASK	0xFFFF
+#define ASUS_WMI_EVENT_BATTERY	0x57
+#define ASUS_WMI_EVENT_AC	0x58
+#define ASUS_WMI_EVENT_FAN_MODE	0x99
+#define ASUS_WMI_EVENT_PROFILE	0xAE
+#define ASUS_WMI_EVENT_AC_2	0xCF
+
+struct armoury_watch {
+	struct kobj_attribute *attr;
+	u32 dev_id;
+};
+
+static const struct armoury_watch armoury_watches[] = {
+	[ARMOURY_WATCH_EGPU_CONNECTED] = { &attr_egpu_connected_current_value,
+					   ASUS_WMI_DEVID_EGPU_CONNECTED },
+	[ARMOURY_WATCH_EGPU] = { &attr_egpu_enable_current_value, ASUS_WMI_DEVID_EGPU },
+	[ARMOURY_WATCH_DGPU] = { &attr_dgpu_disable_current_value, ASUS_WMI_DEVID_DGPU },
+	[ARMOURY_WATCH_CHARGE_MODE] = { &attr_charge_mode_current_value,
+					ASUS_WMI_DEVID_CHARGE_MODE },
+};
+
+/*
+ * The events that change values we hold, with the watched values they
+ * affect. A profile switch from Fn+F5 (0x99 on older machines) has firmware
+ * load new power limits, so it drops the whole cache and write shadow but
+ * has nothing to read again. Other codes are hotkeys asus-nb-wmi handles and
+ * are ignored. No code is known for plugging in an eGPU, one can be found
+ * with the asus_armoury_wmi_event trace event and added here.
+ */
+static const struct armoury_event {
+	u32 code;
+	unsigned long watches;
+	bool all;
+} armoury_event_map[] = {
+	{ ASUS_WMI_EVENT_BATTERY, BIT(ARMOURY_WATCH_CHARGE_MODE), false },
+	{ ASUS_WMI_EVENT_AC, BIT(ARMOURY_WATCH_CHARGE_MODE), false },
+	{ ASUS_WMI_EVENT_AC_2, BIT(ARMOURY_WATCH_CHARGE_MODE), false },
+	{ ASUS_WMI_EVENT_FAN_MODE, 0, true },
+	{ ASUS_WMI_EVENT_PROFILE, 0, true },
+};
+
+static const struct armoury_event *armoury_event_find(u32 code)
+{
+	code &= ASUS_WMI_EVENT_MASK;
+	for (int i = 0; i < ARRAY_SIZE(armoury_event_map); i++) {
+		if (armoury_event_map[i].code == code)
+			return &armoury_event_map[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads the pending watched values again and notifies pollers of those that
+ * changed. The first read after probe always notifies, as the value before
+ * the event is not known. The reads are not for any reader waiting on them,
+ * so they bypass the budget.
+ */
+static void armoury_event_work(struct work_struct *work)
+{
+	struct asus_armoury_priv *priv = container_of(work, struct asus_armoury_priv,
+						      event_work);
+	unsigned long pending = xchg(&priv->watch_pending, 0);
+	const struct armoury_watch *w;
+	bool gpu_changed = false;
+	u32 value;
+	int i;
+
+	for_each_set_bit(i, &pending, ARMOURY_WATCH_COUNT) {
+		w = &armoury_watches[i];
+		if (!asus_wmi_is_present(priv, w->dev_id) ||
+		    __armoury_get_devstate(priv, w->dev_id, &value, false))
+			continue;
+
+		if (test_bit(i, &priv->watch_valid) && priv->watch_value[i] == value)
+			continue;
+		priv->watch_value[i] = value;
+		__set_bit(i, &priv->watch_valid);
+
+		armoury_attr_notify(&priv->fw_attr_kset->kobj, w->attr);
+		if (i == ARMOURY_WATCH_EGPU || i == ARMOURY_WATCH_DGPU)
+			gpu_changed = true;
+	}
+
+	if (gpu_changed && armoury_gpu_mode_visible(priv))
+		armoury_attr_notify(&priv->fw_attr_kset->kobj,
+				    &attr_gpu_mode_current_value);
+}
+
+#ifdef ASUS_WMI_HAS_EVENT_NOTIFIER
+/*
+ * Called by asus-wmi for every event code, before it handles the event.
+ * Drops what a mapped event may have changed behind our back, the watched
+ * values it affects are then read again from the work.
+ */
+static int armoury_event_notify(struct notifier_block *nb, unsigned long code,
+				void *data)
+{
+	struct asus_armoury_priv *priv = container_of(nb, struct asus_armoury_priv,
+						      event_nb);
+	const struct armoury_event *ev = armoury_event_find(code);
+	unsigned long watches = ev ? ev->watches : 0;
+	u32 dev_id;
+	int i;
+
+	trace_asus_armoury_wmi_event(priv->id, code, watches);
+	if (!ev)
+		return NOTIFY_DONE;
+
+	if (ev->all) {
+		armoury_devstate_invalidate_all(priv);
+		armoury_shadow_invalidate_all(priv);
+	}
+
+	for_each_set_bit(i, &watches, ARMOURY_WATCH_COUNT) {
+		dev_id = armoury_watches[i].dev_id;
+		armoury_devstate_invalidate(priv, dev_id);
+		armoury_shadow_update(priv, dev_id, 0, false);
+		set_bit(i, &priv->watch_pending);
+	}
+	if (watches)
+		schedule_work(&priv->event_work);
+
+	return NOTIFY_DONE;
+}
+
+/*
+ * asus-nb-wmi owns the event GUID, and binding to it here would take the
+ * events away from it. Hear the event codes through asus-wmi.
+ */
+static int armoury_event_register(struct asus_armoury_priv *priv)
+{
+	priv->event_nb.notifier_call = armoury_event_notify;
+	return asus_wmi_register_event_notifier(&priv->event_nb);
+}
+
+static void armoury_event_unregister(struct asus_armoury_priv *priv)
+{
+	asus_wmi_unregister_event_notifier(&priv->event_nb);
+}
+#else
+/*
+ * Without patch/05 asus-wmi has no way to pass events on. Values changed
+ * by firmware are then only seen once the cache and write shadow expire.
+ */
+static int armoury_event_register(struct asus_armoury_priv *priv)
+{
+	dev_info(&priv->wdev->dev,
+		 "asus-wmi has no event notifier, firmware changes are not seen\n");
+	return 0;
+}
+
+static void armoury_event_unregister(struct asus_armoury_priv *priv)
+{
+}
+#endif
+
+/**
+ * asus_armoury_add() - Set up one driver instance.
+ * @ops: The firmware backend to use.
+ * @data: Private data of the backend, available as priv->wmi_data.
+ *
+ * Probes the firmware through @ops and creates the class device, attributes
+ * and debugfs tree for the instance.
+ *
+ * Returns: The new instance, or an ERR_PTR().
+ */
+static struct asus_armoury_priv *asus_armoury_add(const struct armoury_wmi_ops *ops,
+						  void *data)
+{
+	struct asus_armoury_priv *priv;
+	struct rog_tunables *rog;
+	ktime_t start = ktime_get();
+	int err;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return ERR_PTR(-ENOMEM);
+
+	rog = kzalloc(sizeof(*rog), GFP_KERNEL);
+	if (!rog) {
+		err = -ENOMEM;
+		goto err_free_priv;
+	}
+	RCU_INIT_POINTER(priv->rog_tunables, rog);
+
+	priv->coalesce = kzalloc(sizeof(*priv->coalesce), GFP_KERNEL);
+	if (!priv->coalesce) {
+		err = -ENOMEM;
+		goto err_free_tunables;
+	}
+
+	priv->wmi_ops = ops;
+	priv->wmi_data = data;
+	mutex_init(&priv->mutex);
+	spin_lock_init(&priv->devstate_lock);
+	spin_lock_init(&priv->state_lock);
+	init_waitqueue_head(&priv->devstate_wq);
+	INIT_WORK(&priv->restore_work, armoury_restore_work);
+	init_completion(&priv->blob_done);
+	INIT_WORK(&priv->event_work, armoury_event_work);
+	spin_lock_init(&priv->coalesce_lock);
+	spin_lock_init(&priv->async_lock);
+	INIT_DELAYED_WORK(&priv->coalesce_work, armoury_coalesce_work);
+
+	priv->id = ida_alloc(&armoury_ida, GFP_KERNEL);
+	if (priv->id < 0) {
+		err = priv->id;
+		goto err_free_coalesce;
+	}
+
+	priv->stats = alloc_percpu(struct armoury_stats);
+	if (!priv->stats) {
+		err = -ENOMEM;
+		goto err_free_id;
+	}
+
+	if (wmi_trace_entries) {
+		priv->wmi_trace = armoury_wmi_trace_alloc(wmi_trace_entries);
+		if (!priv->wmi_trace) {
+			err = -ENOMEM;
+			goto err_free_stats;
+		}
+	}
+
+	priv->state = armoury_state_alloc();
+	if (!priv->state) {
+		err = -ENOMEM;
+		goto err_free_trace;
+	}
+
+	armoury_presence_seed(priv);
+	/* Nothing can read the tunables before the attributes are added */
+	init_rog_tunables(rog);
+	init_max_cpu_cores(priv, rog);
+
+	err = asus_fw_attr_add(priv);
+	if (err)
+		goto err_free_state;
+
+	err = armoury_chardev_add(priv);
+	if (err)
+		goto err_remove_attrs;
+
+	err = armoury_async_add(priv);
+	if (err)
+		dev_warn(priv->fw_attr_dev, "Failed to set up asynchronous stores: %d\n", err);
+	err = armoury_stage_add(priv);
+	if (err)
+		dev_warn(priv->fw_attr_dev, "Failed to set up staged changes: %d\n", err);
+	armoury_state_publish(priv);
+
+	armoury_platform_profile_add(priv);
+
+	priv->probe_us = ktime_us_delta(ktime_get(), start);
+	dev_dbg(priv->fw_attr_dev, "probed in %llu us with %u presence calls\n",
+		priv->probe_us, priv->probe_calls);
+
+	asus_fw_debugfs_init(priv);
+	armoury_blob_request(priv);
+
+	if (priv->id == 0) {
+		mutex_lock(&armoury_primary_lock);
+		armoury_primary = priv;
+		mutex_unlock(&armoury_primary_lock);
+	}
+
+	return priv;
+
+err_remove_attrs:
+	asus_fw_attr_remove(priv);
+err_free_state:
+	free_page((unsigned long)priv->state);
+err_free_trace:
+	kvfree(priv->wmi_trace);
+err_free_stats:
+	free_percpu(priv->stats);
+err_free_id:
+	ida_free(&armoury_ida, priv->id);
+err_free_coalesce:
+	kfree(priv->coalesce);
+err_free_tunables:
+	kfree(rcu_dereference_protected(priv->rog_tunables, true));
+err_free_priv:
+	kfree(priv);
+	return ERR_PTR(err);
+}
+
+static void asus_armoury_del(struct asus_armoury_priv *priv)
+{
+	if (priv->id == 0) {
+		mutex_lock(&armoury_primary_lock);
+		armoury_primary = NULL;
+		mutex_unlock(&armoury_primary_lock);
+	}
+
+	wait_for_completion(&priv->blob_done);
+	armoury_coalesce_flush(priv);
+	disable_delayed_work_sync(&priv->coalesce_work);
+	cancel_work_sync(&priv->restore_work);
+	cancel_work_sync(&priv->event_work);
+	debugfs_remove_recursive(priv->debugfs_root);
+	armoury_platform_profile_remove(priv);
+	armoury_chardev_remove(priv);
+	armoury_stage_remove(priv);
+	armoury_async_remove(priv);
+	asus_fw_attr_remove(priv);
+	kfree(priv->async_slots);
+	armoury_chardev_put(priv);
+	kvfree(priv->wmi_trace);
+	free_percpu(priv->stats);
+	ida_free(&armoury_ida, priv->id);
+	mutex_destroy(&priv->mutex);
+	kfree(priv->coalesce);
+	/* The attributes are gone, so are all readers and writers */
+	kfree(rcu_dereference_protected(priv->rog_tunables, true));
+	kfree(priv);
+}
+
+static int asus_armoury_probe(struct wmi_device *wdev, const void *context)
+{
+	struct asus_armoury_priv *priv;
+	int ret;
+
+	priv = asus_armoury_add(&armoury_asus_wmi_ops, NULL);
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+
+	priv->wdev = wdev;
+	dev_set_drvdata(&wdev->dev, priv);
+
+	ret = armoury_event_register(priv);
+	if (ret) {
+		asus_armoury_del(priv);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void asus_armoury_remove(struct wmi_device *wdev)
+{
+	struct asus_armoury_priv *priv = dev_get_drvdata(&wdev->dev);
+
+	armoury_event_unregister(priv);
+	asus_armoury_del(priv);
+}
+
+static const struct wmi_device_id asus_armoury_id_table[] = {
+	{ .guid_string = ASUS_WMI_MGMT_GUID },
+	{ }
+};
+MODULE_DEVICE_TABLE(wmi, asus_armoury_id_table);
+
+static struct wmi_driver asus_armoury_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = pm_sleep_ptr(&asus_armoury_pm_ops),
+	},
+	.id_table = asus_armoury_id_table,
+	.probe = asus_armoury_probe,
+	.remove = asus_armoury_remove,
+	.no_singleton = true,
+};
+
+/* Mock backend ***************************************************************/
+
+#if IS_ENABLED(CONFIG_ASUS_ARMOURY_MOCK)
+
+static unsigned int mock_instances;
+module_param(mock_instances, uint, 0444);
+MODULE_PARM_DESC(mock_instances,
+		 "Number of instances to create on the in-memory mock WMI backend");
+
+static unsigned int mock_delay_us;
+module_param(mock_delay_us, uint, 0444);
+MODULE_PARM_DESC(mock_delay_us, "Initial per-call latency of the mock WMI backend in us");
+
+/*
+ * State of one device ID in the mock. Every call on a device ID sleeps for
+ * delay_us and then fails with err if that is set. DEVS reports result, and
+ * only stores the new value when result is 1, as firmware would.
+ */
+struct armoury_mock_devstate {
+	bool present;
+	u32 value;
+	u32 result;
+	int err;
+	unsigned int delay_us;
+};
+
+struct armoury_mock {
+	struct asus_armoury_priv *priv;
+	struct armoury_mock_devstate devstate[ARRAY_SIZE(armoury_devids)];
+	spinlock_t lock;
+};
+
+static struct armoury_mock **armoury_mocks;
+
+static struct armoury_mock_devstate *armoury_mock_find(struct armoury_mock *mock,
+							u32 dev_id)
+{
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		if (armoury_devids[i] == dev_id)
+			return &mock->devstate[i];
+	}
+
+	return NULL;
+}
+
+/* Sleeps outside the lock and returns the injected error, if any */
+static int armoury_mock_enter(struct armoury_mock *mock,
+			      struct armoury_mock_devstate *state)
+{
+	unsigned int delay_us;
+	int err;
+
+	spin_lock(&mock->lock);
+	delay_us = state->delay_us;
+	err = state->err;
+	spin_unlock(&mock->lock);
+
+	if (delay_us)
+		fsleep(delay_us);
+
+	return err;
+}
+
+static int armoury_mock_evaluate_method(struct asus_armoury_priv *priv,
+					u32 method_id, u32 arg0, u32 arg1,
+					u32 *retval)
+{
+	struct armoury_mock *mock = priv->wmi_data;
+	struct armoury_mock_devstate *state;
+	int err;
+
+	state = armoury_mock_find(mock, arg0);
+	if (!state)
+		return -ENODEV;
+
+	err = armoury_mock_enter(mock, state);
+	if (err)
+		return err;
+
+	spin_lock(&mock->lock);
+	switch (method_id) {
+	case ASUS_WMI_METHODID_DSTS:
+		*retval = state->present ?
+			  state->value | ASUS_WMI_DSTS_PRESENCE_BIT : 0;
+		break;
+	case ASUS_WMI_METHODID_DEVS:
+		*retval = state->result;
+		if (state->present && state->result == 1)
+			state->value = arg1;
+		break;
+	default:
+		err = -ENODEV;
+		break;
+	}
+	spin_unlock(&mock->lock);
+
+	return err;
+}
+
+static int armoury_mock_get_devstate(struct asus_armoury_priv *priv,
+				     u32 dev_id, u32 *retval)
+{
+	int err;
+
+	err = armoury_mock_evaluate_method(priv, ASUS_WMI_METHODID_DSTS,
+					   dev_id, 0, retval);
+	if (err)
+		return err;
+
+	if (!(*retval & ASUS_WMI_DSTS_PRESENCE_BIT))
+		return -ENODEV;
+
+	return 0;
+}
+
+static int armoury_mock_set_devstate(struct asus_armoury_priv *priv,
+				     u32 dev_id, u32 ctrl_param, u32 *retval)
+{
+	return armoury_mock_evaluate_method(priv, ASUS_WMI_METHODID_DEVS,
+					    dev_id, ctrl_param, retval);
+}
+
+static const struct armoury_wmi_ops armoury_mock_ops = {
+	.evaluate_method = armoury_mock_evaluate_method,
+	.get_devstate = armoury_mock_get_devstate,
+	.set_devstate = armoury_mock_set_devstate,
+};
+
+/*
+ * debugfs mock_devstate: one line per device ID, as
+ * "dev_id present value result err delay_us". Writing a line in the same
+ * format replaces that device ID's entry.
+ */
+static int mock_devstate_show(struct seq_file *m, void *unused)
+{
+	struct armoury_mock *mock = m->private;
+	struct armoury_mock_devstate state;
+
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		spin_lock(&mock->lock);
+		state = mock->devstate[i];
+		spin_unlock(&mock->lock);
+
+		seq_printf(m, "0x%08x %d 0x%x %u %d %u\n", armoury_devids[i],
+			   state.present, state.value, state.result, state.err,
+			   state.delay_us);
+	}
+
+	return 0;
+}
+
+static int mock_devstate_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mock_devstate_show, inode->i_private);
+}
+
+static ssize_t mock_devstate_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct armoury_mock *mock = ((struct seq_file *)file->private_data)->private;
+	struct armoury_mock_devstate *state;
+	unsigned int present, delay_us;
+	u32 dev_id, value, result;
+	char buf[96] = {};
+	int err;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	if (sscanf(buf, "%x %u %x %u %d %u", &dev_id, &present, &value, &result,
+		   &err, &delay_us) != 6)
+		return -EINVAL;
+
+	state = armoury_mock_find(mock, dev_id);
+	if (!state)
+		return -ENODEV;
+
+	spin_lock(&mock->lock);
+	state->present = present;
+	state->value = value;
+	state->result = result;
+	state->err = err;
+	state->delay_us = delay_us;
+	spin_unlock(&mock->lock);
+
+	return count;
 }
 
-static ssize_t cores_efficiency_default_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+static const struct file_operations mock_devstate_fops = {
+	.owner = THIS_MODULE,
+	.open = mock_devstate_open,
+	.read = seq_read,
+	.write = mock_devstate_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void armoury_mock_destroy(void)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_DEFAULT);
+	if (!armoury_mocks)
+		return;
+
+	for (int i = 0; i < mock_instances; i++) {
+		if (!armoury_mocks[i])
+			continue;
+		if (armoury_mocks[i]->priv)
+			asus_armoury_del(armoury_mocks[i]->priv);
+		kfree(armoury_mocks[i]);
+	}
+
+	kfree(armoury_mocks);
+	armoury_mocks = NULL;
 }
 
-static ssize_t cores_efficiency_current_value_show(struct kobject *kobj,
-					struct kobj_attribute *attr, char *buf)
+/*
+ * Every mock starts out with all device IDs present, reading 0 and accepting
+ * writes, so that all attributes are created.
+ */
+static void armoury_mock_init(struct armoury_mock *mock)
 {
-	return cores_value_show(kobj, attr, buf, CPU_CORE_POWER, CPU_CORE_CURRENT);
+	spin_lock_init(&mock->lock);
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		mock->devstate[i].present = true;
+		mock->devstate[i].result = 1;
+		mock->devstate[i].delay_us = mock_delay_us;
+	}
 }
 
-static ssize_t cores_efficiency_current_value_store(struct kobject *kobj,
-					struct kobj_attribute *attr,
-					const char *buf, size_t count)
+static int armoury_mock_create(void)
 {
+	struct asus_armoury_priv *priv;
+	struct armoury_mock *mock;
 	int err;
 
-	err = cores_current_value_store(kobj, attr, buf, CPU_CORE_POWER);
-	if (err)
-		return err;
+	if (!mock_instances)
+		return 0;
 
-	return count;
-}
-ATTR_GROUP_CORES_RW(cores_efficiency, "cores_efficiency",
-		"Set the max available efficiency cores");
+	armoury_mocks = kcalloc(mock_instances, sizeof(*armoury_mocks), GFP_KERNEL);
+	if (!armoury_mocks)
+		return -ENOMEM;
 
-/* Simple attribute creation */
-ATTR_GROUP_ROG_TUNABLE(ppt_pl1_spl, "ppt_pl1_spl", ASUS_WMI_DEVID_PPT_PL1_SPL,
-		cpu_default, cpu_min, cpu_max, 1, "Set the CPU slow package limit");
-ATTR_GROUP_ROG_TUNABLE(ppt_pl2_sppt, "ppt_pl2_sppt", ASUS_WMI_DEVID_PPT_PL2_SPPT,
-		cpu_default, cpu_min, cpu_max, 1, "Set the CPU fast package limit");
-ATTR_GROUP_ROG_TUNABLE(ppt_apu_sppt, "ppt_apu_sppt", ASUS_WMI_DEVID_PPT_APU_SPPT,
-		platform_default, platform_min, platform_max, 1, "Set the CPU slow package limit");
-ATTR_GROUP_ROG_TUNABLE(ppt_platform_sppt, "ppt_platform_sppt", ASUS_WMI_DEVID_PPT_PLAT_SPPT,
-		platform_default, platform_min, platform_max, 1, "Set the CPU slow package limit");
-ATTR_GROUP_ROG_TUNABLE(ppt_fppt, "ppt_fppt", ASUS_WMI_DEVID_PPT_FPPT,
-		cpu_default, cpu_min, cpu_max, 1, "Set the CPU slow package limit");
+	for (int i = 0; i < mock_instances; i++) {
+		mock = kzalloc(sizeof(*mock), GFP_KERNEL);
+		if (!mock) {
+			err = -ENOMEM;
+			goto err_destroy;
+		}
+		armoury_mocks[i] = mock;
+		armoury_mock_init(mock);
 
-ATTR_GROUP_ROG_TUNABLE(nv_dynamic_boost, "nv_dynamic_boost", ASUS_WMI_DEVID_NV_DYN_BOOST,
-		nv_boost_default, nv_boost_min, nv_boost_max, 1, "Set the Nvidia dynamic boost limit");
-ATTR_GROUP_ROG_TUNABLE(nv_temp_target, "nv_temp_target", ASUS_WMI_DEVID_NV_THERM_TARGET,
-		nv_temp_default, nv_boost_min, nv_temp_max, 1, "Set the Nvidia max thermal limit");
-ATTR_GROUP_INT_VALUE_ONLY_RO(dgpu_base_tgp, "dgpu_base_tgp", ASUS_WMI_DEVID_DGPU_BASE_TGP,
-		"Read the base TGP value");
-ATTR_GROUP_ROG_TUNABLE(dgpu_tgp, "dgpu_tgp", ASUS_WMI_DEVID_DGPU_SET_TGP,
-		dgpu_tgp_default, dgpu_tgp_min, dgpu_tgp_max, 1,
-		"Set the additional TGP on top of the base TGP");
+		priv = asus_armoury_add(&armoury_mock_ops, mock);
+		if (IS_ERR(priv)) {
+			err = PTR_ERR(priv);
+			goto err_destroy;
+		}
+		mock->priv = priv;
 
-ATTR_GROUP_ENUM_INT_RO(charge_mode, "charge_mode", ASUS_WMI_DEVID_CHARGE_MODE,
-		"0;1;2", "Show the current mode of charging");
-ATTR_GROUP_BOOL_RW(boot_sound, "boot_sound", ASUS_WMI_DEVID_BOOT_SOUND,
-		"Set the boot POST sound");
-ATTR_GROUP_BOOL_RW(mcu_powersave, "mcu_powersave", ASUS_WMI_DEVID_MCU_POWERSAVE,
-		"Set MCU powersaving mode");
-ATTR_GROUP_BOOL_RW(panel_od, "panel_overdrive", ASUS_WMI_DEVID_PANEL_OD,
-		"Set the panel refresh overdrive");
-ATTR_GROUP_BOOL_RW(panel_hd_mode, "panel_hd_mode", ASUS_WMI_DEVID_PANEL_HD,
-		"Set the panel HD mode to UHD<0> or FHD<1>");
-ATTR_GROUP_BOOL_RO(egpu_connected, "egpu_connected", ASUS_WMI_DEVID_EGPU_CONNECTED,
-		"Show the eGPU connection status");
+		debugfs_create_file("mock_devstate", 0644, priv->debugfs_root,
+				    mock, &mock_devstate_fops);
+	}
 
-/* If an attribute does not require any special case handling add it here */
-static const struct asus_attr_group armoury_attr_groups[] = {
-	{ &egpu_connected_attr_group, ASUS_WMI_DEVID_EGPU_CONNECTED },
-	{ &egpu_enable_attr_group, ASUS_WMI_DEVID_EGPU },
-	{ &dgpu_disable_attr_group, ASUS_WMI_DEVID_DGPU },
+	return 0;
 
-	{ &ppt_pl1_spl_attr_group, ASUS_WMI_DEVID_PPT_PL1_SPL },
-	{ &ppt_pl2_sppt_attr_group, ASUS_WMI_DEVID_PPT_PL2_SPPT },
-	{ &ppt_apu_sppt_attr_group, ASUS_WMI_DEVID_PPT_APU_SPPT },
-	{ &ppt_platform_sppt_attr_group, ASUS_WMI_DEVID_PPT_PLAT_SPPT },
-	{ &ppt_fppt_attr_group, ASUS_WMI_DEVID_PPT_FPPT },
-	{ &nv_dynamic_boost_attr_group, ASUS_WMI_DEVID_NV_DYN_BOOST },
-	{ &nv_temp_target_attr_group, ASUS_WMI_DEVID_NV_THERM_TARGET },
-	{ &dgpu_base_tgp_attr_group, ASUS_WMI_DEVID_DGPU_BASE_TGP },
-	{ &dgpu_tgp_attr_group, ASUS_WMI_DEVID_DGPU_SET_TGP },
-	{ &apu_mem_attr_group, ASUS_WMI_DEVID_APU_MEM },
-	{ &cores_efficiency_attr_group, ASUS_WMI_DEVID_CORES_MAX },
-	{ &cores_performance_attr_group, ASUS_WMI_DEVID_CORES_MAX },
+err_destroy:
+	armoury_mock_destroy();
+	return err;
+}
 
-	{ &charge_mode_attr_group, ASUS_WMI_DEVID_CHARGE_MODE },
-	{ &boot_sound_attr_group, ASUS_WMI_DEVID_BOOT_SOUND },
-	{ &mcu_powersave_attr_group, ASUS_WMI_DEVID_MCU_POWERSAVE },
-	{ &panel_od_attr_group, ASUS_WMI_DEVID_PANEL_OD },
-	{ &panel_hd_mode_attr_group, ASUS_WMI_DEVID_PANEL_HD },
+/* Replay backend *************************************************************/
+
+static char *replay_trace;
+module_param(replay_trace, charp, 0444);
+MODULE_PARM_DESC(replay_trace,
+		 "Firmware file with a recorded wmi_trace to create a replay instance from");
+
+static bool replay_realtime = true;
+module_param(replay_realtime, bool, 0644);
+MODULE_PARM_DESC(replay_realtime,
+		 "Take as long as the recorded call for each replayed one (default: true)");
+
+/*
+ * Answers each call with the next recorded call of the same method on the
+ * same device ID, wrapping around at the end of the trace. The argument of a
+ * call is not matched, calls whose argument differs from the recording are
+ * counted in replay_diverged. A device ID with no recorded calls is absent.
+ */
+struct armoury_replay {
+	struct asus_armoury_priv *priv;
+	const struct firmware *fw;
+	const struct armoury_wmi_trace_rec *recs;
+	u32 count;
+	u32 cursor[ARRAY_SIZE(armoury_devids)];
+	u64 misses;
+	u64 diverged;
+	spinlock_t lock;
 };
 
-static int asus_fw_attr_add(void)
+static struct armoury_replay *armoury_replay;
+
+static int armoury_replay_call(struct armoury_replay *replay, u32 method_id,
+			       u32 dev_id, u32 arg, u32 *retval)
 {
-	int err;
+	const struct armoury_wmi_trace_rec *rec = NULL;
+	int idx = -1;
 
-	err = fw_attributes_class_get(&fw_attr_class);
-	if (err)
-		goto fail_class_created;
+	for (int i = 0; i < ARRAY_SIZE(armoury_devids); i++) {
+		if (armoury_devids[i] == dev_id)
+			idx = i;
+	}
 
-	asus_armoury.fw_attr_dev = device_create(fw_attr_class, NULL,
-		MKDEV(0, 0), NULL, "%s", DRIVER_NAME);
+	spin_lock(&replay->lock);
+	for (u32 n = 0; idx >= 0 && n < replay->count; n++) {
+		u32 i = (replay->cursor[idx] + n) % replay->count;
 
-	if (IS_ERR(asus_armoury.fw_attr_dev)) {
-		err = PTR_ERR(asus_armoury.fw_attr_dev);
-		goto fail_class_created;
+		if (replay->recs[i].method_id == method_id &&
+		    replay->recs[i].dev_id == dev_id) {
+			rec = &replay->recs[i];
+			replay->cursor[idx] = i + 1;
+			break;
+		}
 	}
+	if (!rec)
+		replay->misses++;
+	else if (rec->arg != arg)
+		replay->diverged++;
+	spin_unlock(&replay->lock);
 
-	asus_armoury.fw_attr_kset = kset_create_and_add("attributes", NULL,
-				&asus_armoury.fw_attr_dev->kobj);
-	if (!asus_armoury.fw_attr_dev) {
-		err = -ENOMEM;
-		pr_debug("Failed to create and add attributes\n");
-		goto err_destroy_classdev;
-	}
+	if (!rec)
+		return -ENODEV;
 
-	err = sysfs_create_file(&asus_armoury.fw_attr_kset->kobj, &pending_reboot.attr);
-	if (err) {
-		pr_warn("Failed to create sysfs level attributes\n");
-		goto fail_class_created;
-	}
+	if (READ_ONCE(replay_realtime) && rec->duration_ns >= NSEC_PER_USEC)
+		fsleep(rec->duration_ns / NSEC_PER_USEC);
 
-	err = 0;
-	asus_armoury.mini_led_dev_id = 0;
-	if (asus_wmi_is_present(ASUS_WMI_DEVID_MINI_LED_MODE)) {
-		asus_armoury.mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE;
-		err = sysfs_create_group(&asus_armoury.fw_attr_kset->kobj,
-			&mini_led_mode_attr_group);
-	} else if (asus_wmi_is_present(ASUS_WMI_DEVID_MINI_LED_MODE2)) {
-		asus_armoury.mini_led_dev_id = ASUS_WMI_DEVID_MINI_LED_MODE2;
-		err = sysfs_create_group(&asus_armoury.fw_attr_kset->kobj,
-			&mini_led_mode_attr_group);
-	}
-	if (err)
-		pr_warn("Failed to create sysfs-group for mini_led\n");
+	*retval = rec->retval;
+	return rec->err;
+}
 
-	err = 0;
-	asus_armoury.gpu_mux_dev_id = 0;
-	if (asus_wmi_is_present(ASUS_WMI_DEVID_GPU_MUX)) {
-		asus_armoury.gpu_mux_dev_id = ASUS_WMI_DEVID_GPU_MUX;
-		err = sysfs_create_group(&asus_armoury.fw_attr_kset->kobj, &gpu_mux_mode_attr_group);
-	} else if (asus_wmi_is_present(ASUS_WMI_DEVID_GPU_MUX_VIVO)) {
-		asus_armoury.gpu_mux_dev_id = ASUS_WMI_DEVID_GPU_MUX_VIVO;
-		err = sysfs_create_group(&asus_armoury.fw_attr_kset->kobj, &gpu_mux_mode_attr_group);
-	}
-	if (err)
-		pr_warn("Failed to create sysfs-group for gpu_mux\n");
+static int armoury_replay_evaluate_method(struct asus_armoury_priv *priv,
+					  u32 method_id, u32 arg0, u32 arg1,
+					  u32 *retval)
+{
+	return armoury_replay_call(priv->wmi_data, method_id, arg0, arg1, retval);
+}
 
-	for (int i = 0; i < ARRAY_SIZE(armoury_attr_groups); i++) {
-		/* Do not show for the Ally devices as powersave is entirely unreliable on it */
-		if (armoury_attr_groups[i].wmi_devid == ASUS_WMI_DEVID_MCU_POWERSAVE &&
-				dmi_check_system(asus_rog_ally_device))
-			continue;
+static int armoury_replay_get_devstate(struct asus_armoury_priv *priv,
+				       u32 dev_id, u32 *retval)
+{
+	return armoury_replay_call(priv->wmi_data, ASUS_WMI_METHODID_DSTS,
+				   dev_id, 0, retval);
+}
 
-		if (!asus_wmi_is_present(armoury_attr_groups[i].wmi_devid))
-			continue;
+static int armoury_replay_set_devstate(struct asus_armoury_priv *priv,
+				       u32 dev_id, u32 ctrl_param, u32 *retval)
+{
+	return armoury_replay_call(priv->wmi_data, ASUS_WMI_METHODID_DEVS,
+				   dev_id, ctrl_param, retval);
+}
 
-		err = sysfs_create_group(&asus_armoury.fw_attr_kset->kobj,
-			armoury_attr_groups[i].attr_group);
-		if (err)
-			pr_warn("Failed to create sysfs-group for %s\n",
-				armoury_attr_groups[i].attr_group->name);
-		else
-			pr_debug("Created sysfs-group for %s\n",
-				armoury_attr_groups[i].attr_group->name);
-	}
+static const struct armoury_wmi_ops armoury_replay_ops = {
+	.evaluate_method = armoury_replay_evaluate_method,
+	.get_devstate = armoury_replay_get_devstate,
+	.set_devstate = armoury_replay_set_devstate,
+};
 
-	return 0;
+static int armoury_replay_validate(const struct firmware *fw)
+{
+	const struct armoury_wmi_trace_hdr *hdr = (const void *)fw->data;
 
-err_destroy_classdev:
-	device_destroy(fw_attr_class, MKDEV(0, 0));
+	if (fw->size < sizeof(*hdr) ||
+	    hdr->magic != ARMOURY_WMI_TRACE_MAGIC ||
+	    hdr->version != ARMOURY_WMI_TRACE_VERSION ||
+	    hdr->rec_size != sizeof(struct armoury_wmi_trace_rec))
+		return -EINVAL;
 
-fail_class_created:
-	fw_attributes_class_put();
-	return err;
+	if (fw->size != sizeof(*hdr) +
+			(size_t)hdr->count * sizeof(struct armoury_wmi_trace_rec))
+		return -EINVAL;
+
+	return 0;
 }
 
-/* Init / exit ****************************************************************/
+static void armoury_replay_destroy(void)
+{
+	if (!armoury_replay)
+		return;
+
+	if (armoury_replay->priv)
+		asus_armoury_del(armoury_replay->priv);
+	release_firmware(armoury_replay->fw);
+	kfree(armoury_replay);
+	armoury_replay = NULL;
+}
 
-/* Set up the min/max and defaults for ROG tunables */
-static void init_rog_tunables(struct rog_tunables *rog)
+static int armoury_replay_create(void)
 {
-	const char *product;
-	u32 max_boost = NVIDIA_BOOST_MAX;
-	u32 cpu_default = PPT_CPU_LIMIT_DEFAULT;
-	u32 cpu_max = PPT_CPU_LIMIT_MAX;
-	u32 platform_default = PPT_PLATFORM_DEFAULT;
-	u32 platform_max = PPT_PLATFORM_MAX;
+	const struct armoury_wmi_trace_hdr *hdr;
+	struct asus_armoury_priv *priv;
+	struct armoury_replay *replay;
+	int err;
 
-	/*
-	 * ASUS product_name contains everything required, e.g,
-	 * "ROG Flow X16 GV601VV_GV601VV_00185149B"
-	 */
-	product = dmi_get_system_info(DMI_PRODUCT_NAME);
+	if (!replay_trace)
+		return 0;
 
-	if (strstr(product, "GA402R")) {
-		cpu_default = 125;
-	} else if (strstr(product, "13QY")) {
-		cpu_max = 250;
-	} else if (strstr(product, "X13")) {
-		cpu_max = 75;
-		cpu_default = 50;
-	} else if (strstr(product, "RC71")
-		|| strstr(product, "RC72")) {
-		cpu_max = 50;
-		cpu_default = 30;
-	} else if (strstr(product, "G814")
-		|| strstr(product, "G614")
-		|| strstr(product, "G834")
-		|| strstr(product, "G634")) {
-		cpu_max = 175;
-	} else if (strstr(product, "GA402X")
-		|| strstr(product, "GA403")
-		|| strstr(product, "FA507N")
-		|| strstr(product, "FA507X")
-		|| strstr(product, "FA707N")
-		|| strstr(product, "FA707X")) {
-		cpu_max = 90;
+	replay = kzalloc(sizeof(*replay), GFP_KERNEL);
+	if (!replay)
+		return -ENOMEM;
+	armoury_replay = replay;
+	spin_lock_init(&replay->lock);
+
+	err = request_firmware(&replay->fw, replay_trace, NULL);
+	if (err)
+		goto err_destroy;
+
+	err = armoury_replay_validate(replay->fw);
+	if (err) {
+		pr_err("%s is not a usable WMI trace\n", replay_trace);
+		goto err_destroy;
 	}
 
-	if (strstr(product, "GZ301ZE"))
-		max_boost = 5;
-	else if (strstr(product, "FX507ZC4"))
-		max_boost = 15;
-	else if (strstr(product, "GU605"))
-		max_boost = 20;
+	hdr = (const void *)replay->fw->data;
+	replay->recs = (const void *)(hdr + 1);
+	replay->count = hdr->count;
 
-	/* ensure defaults for tunables */
-	rog->cpu_default = cpu_default;
-	rog->cpu_min = PPT_CPU_LIMIT_MIN;
-	rog->cpu_max = cpu_max;
+	priv = asus_armoury_add(&armoury_replay_ops, replay);
+	if (IS_ERR(priv)) {
+		err = PTR_ERR(priv);
+		goto err_destroy;
+	}
+	replay->priv = priv;
 
-	rog->platform_default = platform_default;
-	rog->platform_max = PPT_PLATFORM_MIN;
-	rog->platform_max = platform_max;
+	debugfs_create_u64("replay_misses", 0444, priv->debugfs_root,
+			   &replay->misses);
+	debugfs_create_u64("replay_diverged", 0444, priv->debugfs_root,
+			   &replay->diverged);
 
-	rog->ppt_pl1_spl = cpu_default;
-	rog->ppt_pl2_sppt = cpu_default;
-	rog->ppt_apu_sppt = cpu_default;
+	return 0;
 
-	rog->ppt_platform_sppt = platform_default;
-	rog->ppt_fppt = cpu_default;
+err_destroy:
+	armoury_replay_destroy();
+	return err;
+}
 
-	rog->nv_boost_default = NVIDIA_BOOST_MAX;
-	rog->nv_boost_max = NVIDIA_BOOST_MIN;
-	rog->nv_boost_max = max_boost;
-	rog->nv_dynamic_boost = NVIDIA_BOOST_MIN;
+#else
 
-	rog->nv_temp_default = NVIDIA_TEMP_MAX;
-	rog->nv_temp_max = NVIDIA_TEMP_MIN;
-	rog->nv_temp_max = NVIDIA_TEMP_MAX;
-	rog->nv_temp_target = NVIDIA_TEMP_MIN;
+static inline int armoury_mock_create(void)
+{
+	return 0;
+}
 
-	rog->dgpu_tgp_default = NVIDIA_POWER_DEFAULT;
-	rog->dgpu_tgp_min = NVIDIA_POWER_MIN;
-	rog->dgpu_tgp_max = NVIDIA_POWER_MAX;
-	rog->dgpu_tgp = NVIDIA_POWER_MAX;
+static inline void armoury_mock_destroy(void)
+{
+}
 
+static inline int armoury_replay_create(void)
+{
+	return 0;
 }
 
-static int __init asus_fw_init(void)
+static inline void armoury_replay_destroy(void)
 {
-	int err;
+}
 
-	fw_attrs.pending_reboot = false;
+#endif /* CONFIG_ASUS_ARMOURY_MOCK */
 
-	asus_armoury.rog_tunables = kzalloc(sizeof(struct rog_tunables), GFP_KERNEL);
-	if (!asus_armoury.rog_tunables) {
-		return -ENOMEM;
-	}
-	init_rog_tunables(asus_armoury.rog_tunables);
-	init_max_cpu_cores();
+static int __init asus_armoury_init(void)
+{
+	int err;
+
+	armoury_fw_budget_init();
 
-	err = asus_fw_attr_add();
+	err = armoury_profiles_register();
 	if (err)
 		return err;
 
+	err = wmi_driver_register(&asus_armoury_driver);
+	if (err)
+		goto err_unregister_profiles;
+
+	err = armoury_mock_create();
+	if (err)
+		goto err_unregister;
+
+	err = armoury_replay_create();
+	if (err)
+		goto err_destroy_mock;
+
 	return 0;
+
+err_destroy_mock:
+	armoury_mock_destroy();
+err_unregister:
+	wmi_driver_unregister(&asus_armoury_driver);
+err_unregister_profiles:
+	armoury_profiles_unregister();
+	return err;
 }
 
-static void __exit asus_fw_exit(void)
+static void __exit asus_armoury_exit(void)
 {
-	mutex_lock(&asus_armoury.mutex);
-
-	sysfs_remove_file(&asus_armoury.fw_attr_kset->kobj, &pending_reboot.attr);
-	kset_unregister(asus_armoury.fw_attr_kset);
-	device_destroy(fw_attr_class, MKDEV(0, 0));
-	fw_attributes_class_put();
-
-	mutex_unlock(&asus_armoury.mutex);
+	armoury_replay_destroy();
+	armoury_mock_destroy();
+	wmi_driver_unregister(&asus_armoury_driver);
+	armoury_profiles_unregister();
 }
 
-module_init(asus_fw_init);
-module_exit(asus_fw_exit);
+module_init(asus_armoury_init);
+module_exit(asus_armoury_exit);
+
+#if IS_ENABLED(CONFIG_ASUS_ARMOURY_KUNIT_TEST)
+#include "asus-armoury-test.c"
+#endif
 
 MODULE_AUTHOR("Luke Jones <luke@ljones.dev>");
 MODULE_DESCRIPTION("ASUS BIOS Configuration Driver");
 MODULE_LICENSE("GPL");
-MODULE_ALIAS("wmi:"ASUS_NB_WMI_EVENT_GUID);
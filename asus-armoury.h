@@ -14,8 +14,11 @@
 
 static ssize_t attr_int_store(struct kobject *kobj, struct kobj_attribute *attr,
 				const char *buf, size_t count,
-				u32 min, u32 max, u32 *store_value, u32 wmi_dev);
-
+				u32 min, u32 max, u32 wmi_dev);
+struct asus_armoury_priv;
+static struct asus_armoury_priv *armoury_priv(struct kobject *kobj);
+static int armoury_get_devstate(struct asus_armoury_priv *priv, u32 dev_id, u32 *retval);
+static const char *armoury_attr_group_name(struct kobj_attribute *attr);
 
 static ssize_t int_type_show(struct kobject *kobj, struct kobj_attribute *attr,
 			 char *buf)
@@ -47,16 +50,17 @@ static ssize_t _attr##_store(struct kobject *kobj,				\
 			struct kobj_attribute *attr,				\
 			const char *buf, size_t count)				\
 {										\
-	return attr_int_store(kobj, attr, buf, count, _min, _max, NULL, _wmi);	\
+	return attr_int_store(kobj, attr, buf, count, _min, _max, _wmi);	\
 }
 
 #define WMI_SHOW_INT(_attr, _fmt, _wmi)				\
 static ssize_t _attr##_show(struct kobject *kobj,		\
 			struct kobj_attribute *attr, char *buf)	\
 {								\
+	struct asus_armoury_priv *priv = armoury_priv(kobj);	\
 	u32 result;						\
 	int err;						\
-	err = asus_wmi_get_devstate_dsts(_wmi, &result);	\
+	err = armoury_get_devstate(priv, _wmi, &result);	\
 	if (err)						\
 		return err;					\
 	return sysfs_emit(buf, _fmt,				\
@@ -203,20 +207,39 @@ static const struct attribute_group _attrname##_attr_group = {	\
  * require rog_tunables members.
  */
 
+/* Reads one member of the RCU-published rog_tunables */
+#define armoury_tunables_read(_priv, _field) ({				\
+	u32 __val;							\
+									\
+	rcu_read_lock();						\
+	__val = rcu_dereference((_priv)->rog_tunables)->_field;		\
+	rcu_read_unlock();						\
+	__val;								\
+})
+
 #define __ROG_TUNABLE_RW(_attr, _min, _max, _wmi)			\
 static ssize_t _attr##_current_value_store(struct kobject *kobj,	\
 			struct kobj_attribute *attr,			\
 			const char *buf, size_t count)			\
 {									\
-	return attr_int_store(kobj, attr, buf, count,			\
-		asus_armoury.rog_tunables->_min,			\
-		asus_armoury.rog_tunables->_max,			\
-		&asus_armoury.rog_tunables->_attr, _wmi);		\
+	struct asus_armoury_priv *priv = armoury_priv(kobj);		\
+	struct rog_tunables *rog;					\
+	u32 min, max;							\
+									\
+	rcu_read_lock();						\
+	rog = rcu_dereference(priv->rog_tunables);			\
+	min = rog->_min;						\
+	max = rog->_max;						\
+	rcu_read_unlock();						\
+									\
+	return attr_int_store(kobj, attr, buf, count, min, max, _wmi);	\
 }									\
 static ssize_t _attr##_current_value_show(struct kobject *kobj,		\
 			struct kobj_attribute *attr, char *buf)		\
 {									\
-	return sysfs_emit(buf, "%u\n", asus_armoury.rog_tunables->_attr);\
+	struct asus_armoury_priv *priv = armoury_priv(kobj);		\
+									\
+	return sysfs_emit(buf, "%u\n", armoury_tunables_read(priv, _attr));	\
 }									\
 static struct kobj_attribute attr_##_attr##_current_value =		\
 	__ASUS_ATTR_RW(_attr, current_value)
@@ -225,7 +248,9 @@ static struct kobj_attribute attr_##_attr##_current_value =		\
 static ssize_t _attrname##_##_prop##_show(struct kobject *kobj,		\
 			struct kobj_attribute *attr, char *buf)		\
 {									\
-	return sysfs_emit(buf, "%d\n", asus_armoury.rog_tunables->_val);\
+	struct asus_armoury_priv *priv = armoury_priv(kobj);		\
+									\
+	return sysfs_emit(buf, "%d\n", armoury_tunables_read(priv, _val));	\
 }									\
 static struct kobj_attribute attr_##_attrname##_##_prop =		\
 	__ASUS_ATTR_RO(_attrname, _prop)
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Latency and throughput of the asus-armoury firmware attributes.
+ *
+ * Measures the latency of reads and writes of one current_value, reads per
+ * second from one and from several threads, and the time from a write to the
+ * wakeup of a poll() on the same file. Every result is printed as one
+ * "key value" line, latencies in ns.
+ *
+ * Writes change the attribute, so they are only made on a mock instance
+ * (one with mock_devstate in debugfs) or with -w.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KSFT_PASS	0
+#define KSFT_FAIL	1
+#define KSFT_SKIP	4
+
+static const char *instance = "asus-armoury";
+static const char *attr = "boot_sound";
+static const char *values[2] = { "0", "1" };
+static unsigned int iterations = 10000;
+static unsigned int poll_iterations = 1000;
+static unsigned int threads = 4;
+static unsigned int seconds = 2;
+static bool force_writes;
+
+static char path[256];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *name, uint64_t *ns, unsigned int n)
+{
+	static const struct {
+		const char *key;
+		unsigned int permille;
+	} pct[] = {
+		{ "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 },
+	};
+
+	qsort(ns, n, sizeof(*ns), cmp_u64);
+
+	for (unsigned int i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf("%s.%s %llu\n", name, pct[i].key,
+		       (unsigned long long)ns[(uint64_t)(n - 1) * pct[i].permille / 1000]);
+	printf("%s.min %llu\n", name, (unsigned long long)ns[0]);
+	printf("%s.max %llu\n", name, (unsigned long long)ns[n - 1]);
+}
+
+static int read_value(int fd)
+{
+	char buf[64];
+
+	return pread(fd, buf, sizeof(buf), 0) < 0 ? -errno : 0;
+}
+
+static int write_value(int fd, unsigned int i)
+{
+	const char *value = values[i & 1];
+
+	return pwrite(fd, value, strlen(value), 0) < 0 ? -errno : 0;
+}
+
+static int bench_latency(const char *name, int flags, bool write)
+{
+	uint64_t *ns, start;
+	int fd, err = 0;
+
+	ns = calloc(iterations, sizeof(*ns));
+	if (!ns)
+		return -ENOMEM;
+
+	fd = open(path, flags);
+	if (fd < 0) {
+		err = -errno;
+		goto out_free;
+	}
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		start = now_ns();
+		err = write ? write_value(fd, i) : read_value(fd);
+		ns[i] = now_ns() - start;
+		if (err)
+			goto out_close;
+	}
+
+	print_percentiles(name, ns, iterations);
+
+out_close:
+	close(fd);
+out_free:
+	free(ns);
+	return err;
+}
+
+struct reader {
+	pthread_t thread;
+	volatile bool *stop;
+	uint64_t ops;
+	int err;
+};
+
+static void *reader_fn(void *arg)
+{
+	struct reader *r = arg;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		r->err = -errno;
+		return NULL;
+	}
+
+	while (!*r->stop) {
+		r->err = read_value(fd);
+		if (r->err)
+			break;
+		r->ops++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int bench_throughput(const char *name, unsigned int n)
+{
+	volatile bool stop = false;
+	struct reader *r;
+	uint64_t ops = 0, start, elapsed;
+	int err = 0;
+
+	r = calloc(n, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	start = now_ns();
+	for (unsigned int i = 0; i < n; i++) {
+		r[i].stop = &stop;
+		err = -pthread_create(&r[i].thread, NULL, reader_fn, &r[i]);
+		if (err) {
+			n = i;
+			break;
+		}
+	}
+
+	if (!err)
+		sleep(seconds);
+	stop = true;
+
+	for (unsigned int i = 0; i < n; i++) {
+		pthread_join(r[i].thread, NULL);
+		ops += r[i].ops;
+		if (r[i].err && !err)
+			err = r[i].err;
+	}
+	elapsed = now_ns() - start;
+
+	if (!err)
+		printf("%s.ops_per_sec %llu\n", name,
+		       (unsigned long long)(ops * 1000000000ull / elapsed));
+
+	free(r);
+	return err;
+}
+
+/*
+ * The poller reads current_value and waits for POLLPRI, the main thread
+ * stamps the time right before each write. The difference to the poller's
+ * wakeup includes the write itself, since sysfs_notify() runs in the store.
+ */
+struct poller {
+	pthread_t thread;
+	volatile int ready;
+	volatile uint64_t written;
+	uint64_t *ns;
+	int err;
+};
+
+static void *poller_fn(void *arg)
+{
+	struct poller *p = arg;
+	struct pollfd pfd = { .events = POLLPRI | POLLERR };
+	int ret;
+
+	pfd.fd = open(path, O_RDONLY);
+	if (pfd.fd < 0) {
+		p->err = -errno;
+		p->ready = -1;
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < poll_iterations; i++) {
+		p->err = read_value(pfd.fd);
+		if (p->err)
+			break;
+
+		__atomic_store_n(&p->ready, i + 1, __ATOMIC_RELEASE);
+		ret = poll(&pfd, 1, 1000);
+		if (ret <= 0) {
+			p->err = ret ? -errno : -ETIMEDOUT;
+			break;
+		}
+		p->ns[i] = now_ns() - __atomic_load_n(&p->written, __ATOMIC_ACQUIRE);
+	}
+
+	if (p->err)
+		__atomic_store_n(&p->ready, -1, __ATOMIC_RELEASE);
+	close(pfd.fd);
+	return NULL;
+}
+
+static int bench_poll(void)
+{
+	struct poller p = {};
+	int fd, ready, err;
+
+	p.ns = calloc(poll_iterations, sizeof(*p.ns));
+	if (!p.ns)
+		return -ENOMEM;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		err = -errno;
+		goto out_free;
+	}
+
+	err = -pthread_create(&p.thread, NULL, poller_fn, &p);
+	if (err)
+		goto out_close;
+
+	for (unsigned int i = 0; i < poll_iterations; i++) {
+		while ((ready = __atomic_load_n(&p.ready, __ATOMIC_ACQUIRE)) >= 0 &&
+		       ready != (int)i + 1)
+			sched_yield();
+		if (ready < 0)
+			break;
+
+		/* Give the poller time to go to sleep in poll() */
+		usleep(200);
+
+		__atomic_store_n(&p.written, now_ns(), __ATOMIC_RELEASE);
+		err = write_value(fd, i);
+		if (err)
+			break;
+	}
+
+	if (err)
+		pthread_cancel(p.thread);
+	pthread_join(p.thread, NULL);
+	if (!err)
+		err = p.err;
+	if (!err)
+		print_percentiles("poll_wakeup_ns", p.ns, poll_iterations);
+
+out_close:
+	close(fd);
+out_free:
+	free(p.ns);
+	return err;
+}
+
+static bool is_mock(void)
+{
+	char mock[256];
+
+	snprintf(mock, sizeof(mock), "/sys/kernel/debug/%s/mock_devstate",
+		 instance);
+	return !access(mock, F_OK);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-i instance] [-a attribute] [-v value0,value1]\n"
+		"          [-n iterations] [-p poll iterations] [-t threads]\n"
+		"          [-s seconds] [-w]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	bool writes;
+	char *comma;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "i:a:v:n:p:t:s:wh")) != -1) {
+		switch (opt) {
+		case 'i':
+			instance = optarg;
+			break;
+		case 'a':
+			attr = optarg;
+			break;
+		case 'v':
+			comma = strchr(optarg, ',');
+			if (!comma) {
+				usage(argv[0]);
+				return KSFT_FAIL;
+			}
+			*comma = '\0';
+			values[0] = optarg;
+			values[1] = comma + 1;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			poll_iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			force_writes = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? KSFT_PASS : KSFT_FAIL;
+		}
+	}
+
+	if (!iterations || !poll_iterations || !threads || !seconds) {
+		usage(argv[0]);
+		return KSFT_FAIL;
+	}
+
+	snprintf(path, sizeof(path),
+		 "/sys/class/firmware-attributes/%s/attributes/%s/current_value",
+		 instance, attr);
+	if (access(path, R_OK)) {
+		printf("# %s: %s, skipping\n", path, strerror(errno));
+		return KSFT_SKIP;
+	}
+
+	writes = force_writes || is_mock();
+
+	err = bench_latency("read_ns", O_RDONLY, false);
+	if (!err)
+		err = bench_throughput("read_1thread", 1);
+	if (!err && threads > 1) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "read_%uthreads", threads);
+		err = bench_throughput(name, threads);
+	}
+
+	if (!err && !writes)
+		printf("# %s is not a mock instance, skipping writes (use -w)\n",
+		       instance);
+	if (!err && writes)
+		err = bench_latency("write_ns", O_WRONLY, true);
+	if (!err && writes)
+		err = bench_poll();
+
+	if (err) {
+		printf("# %s: %s\n", attr, strerror(-err));
+		return KSFT_FAIL;
+	}
+
+	return KSFT_PASS;
+}